@@ -0,0 +1,180 @@
+#include <string.h>
+#include "bl_lz.h"
+
+#define BL_LZ_WINDOW_MASK       (BL_LZ_WINDOW_SIZE - 1)
+
+typedef char bl_lz_flush_size_check[(BL_LZ_WINDOW_SIZE % BL_LZ_FLUSH_SIZE) == 0 ? 1 : -1];
+
+/*
+ * 输出直接写进窗口, 窗口按 BL_LZ_FLUSH_SIZE 分段, 每段写满就交给 flush (写 flash)。
+ * 未 flush 的部分不超过一段, 不会被后续输出覆盖; 已 flush 的部分留作匹配的历史。
+ * 一次拷贝不跨 flush 边界, 因此也不会跨窗口尾部回绕。
+ */
+
+void bl_lz_init(bl_lz_t *lz, uint8_t *window, uint32_t limit, bl_lz_flush_t flush, void *arg)
+{
+    memset(lz, 0, sizeof(*lz));
+
+    lz->window = window;
+    lz->limit = limit;
+    lz->flush = flush;
+    lz->arg = arg;
+    lz->state = BL_LZ_TOKEN;
+}
+
+/* 到下一个 flush 边界还能输出的字节数, 同时受输出上限约束 */
+static uint32_t bl_lz_room(const bl_lz_t *lz)
+{
+    uint32_t room = BL_LZ_FLUSH_SIZE - (lz->pos - lz->flushed);
+
+    if (room > lz->limit - lz->pos)
+        room = lz->limit - lz->pos;
+    return room;
+}
+
+static bool bl_lz_flush_full(bl_lz_t *lz)
+{
+    if (lz->pos - lz->flushed < BL_LZ_FLUSH_SIZE)
+        return true;
+
+    const uint8_t *data = &lz->window[lz->flushed & BL_LZ_WINDOW_MASK];
+    lz->flushed += BL_LZ_FLUSH_SIZE;
+    return lz->flush(data, BL_LZ_FLUSH_SIZE, lz->arg);
+}
+
+bool bl_lz_feed(bl_lz_t *lz, const uint8_t *in, uint32_t length)
+{
+    const uint8_t *end = in + length;
+
+    /* 匹配拷贝不消耗输入, 输入用完后也要把它做完 */
+    while (in < end || lz->state == BL_LZ_MATCH)
+    {
+        switch (lz->state)
+        {
+            case BL_LZ_TOKEN:
+            {
+                uint8_t token = *in++;
+                lz->lit_len   = token >> 4;
+                lz->match_len = (token & 0x0F) + BL_LZ_MIN_MATCH;
+                lz->match_ext = (token & 0x0F) == 0x0F;
+
+                if (lz->lit_len == 0x0F)
+                    lz->state = BL_LZ_LIT_LEN;
+                else
+                    lz->state = lz->lit_len ? BL_LZ_LITERAL : BL_LZ_OFF_LO;
+                break;
+            }
+            case BL_LZ_LIT_LEN:
+            {
+                uint8_t b = *in++;
+                lz->lit_len += b;
+                if (b != 0xFF)
+                    lz->state = BL_LZ_LITERAL;
+                break;
+            }
+            case BL_LZ_LITERAL:
+            {
+                uint32_t n = bl_lz_room(lz);
+                if (n > lz->lit_len)
+                    n = lz->lit_len;
+                if (n > (uint32_t)(end - in))
+                    n = end - in;
+                if (n == 0)
+                {
+                    lz->state = BL_LZ_ERROR;   // 超出输出上限
+                    return false;
+                }
+
+                memcpy(&lz->window[lz->pos & BL_LZ_WINDOW_MASK], in, n);
+                in += n;
+                lz->pos += n;
+                lz->lit_len -= n;
+
+                if (!bl_lz_flush_full(lz))
+                {
+                    lz->state = BL_LZ_ERROR;
+                    return false;
+                }
+
+                if (lz->lit_len == 0)
+                    lz->state = BL_LZ_OFF_LO;
+                break;
+            }
+            case BL_LZ_OFF_LO:
+            {
+                lz->offset = *in++;
+                lz->state = BL_LZ_OFF_HI;
+                break;
+            }
+            case BL_LZ_OFF_HI:
+            {
+                lz->offset |= (uint32_t)(*in++) << 8;
+                if (lz->offset == 0 || lz->offset > BL_LZ_WINDOW_SIZE || lz->offset > lz->pos)
+                {
+                    lz->state = BL_LZ_ERROR;
+                    return false;
+                }
+                lz->state = lz->match_ext ? BL_LZ_MATCH_LEN : BL_LZ_MATCH;
+                break;
+            }
+            case BL_LZ_MATCH_LEN:
+            {
+                uint8_t b = *in++;
+                lz->match_len += b;
+                if (b != 0xFF)
+                    lz->state = BL_LZ_MATCH;
+                break;
+            }
+            case BL_LZ_MATCH:
+            {
+                uint32_t n = bl_lz_room(lz);
+                if (n > lz->match_len)
+                    n = lz->match_len;
+                if (n == 0)
+                {
+                    lz->state = BL_LZ_ERROR;
+                    return false;
+                }
+
+                /* 源和目的可能重叠 (offset < n), 必须逐字节向前拷贝 */
+                uint8_t *win = lz->window;
+                uint32_t dst = lz->pos;
+                uint32_t src = lz->pos - lz->offset;
+                for (uint32_t i = 0; i < n; i++)
+                    win[(dst + i) & BL_LZ_WINDOW_MASK] = win[(src + i) & BL_LZ_WINDOW_MASK];
+
+                lz->pos += n;
+                lz->match_len -= n;
+
+                if (!bl_lz_flush_full(lz))
+                {
+                    lz->state = BL_LZ_ERROR;
+                    return false;
+                }
+
+                if (lz->match_len == 0)
+                    lz->state = BL_LZ_TOKEN;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* 输入结束: 必须停在 sequence 边界或最后一段字面量之后, 再把剩余输出交给 flush */
+bool bl_lz_finish(bl_lz_t *lz)
+{
+    if (lz->state != BL_LZ_TOKEN && lz->state != BL_LZ_OFF_LO)
+        return false;
+
+    if (lz->pos == lz->flushed)
+        return true;
+
+    const uint8_t *data = &lz->window[lz->flushed & BL_LZ_WINDOW_MASK];
+    uint32_t n = lz->pos - lz->flushed;
+    lz->flushed = lz->pos;
+    return lz->flush(data, n, lz->arg);
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <string.h>
+#include "bl_parser.h"
+
+/*
+ * 帧解析直接在接收环上进行:
+ *   - 用 memchr 在连续可读段里找帧头, 帧头之前的字节整段丢弃
+ *   - 帧头到齐后一次性检查 opcode/length, 不合法则只丢掉这个 0xAA 重新同步
+ *   - CRC 随数据到达逐段累加, 帧尾到齐时只需比较两个字节
+ *   - 帧不跨环尾时 payload 直接指向环内数据, 跨环尾时才从块池借一块拷贝进去
+ * 帧处理完之前不释放环空间, 因此 payload 视图在 bl_parser_release 前一直有效。
+ * 需要在处理完之后继续持有的帧 (如交给 flash 任务队列) 用 bl_parser_detach 转到池块中,
+ * 环空间立即释放, 解析器可以接着解析下一帧。
+ */
+
+static void bl_parser_put_slot(bl_parser_t *parser)
+{
+    bl_pool_free(parser->pool, parser->slot);
+    parser->slot = NULL;
+}
+
+static void bl_parser_drop_header(bl_parser_t *parser)
+{
+    rb_commit_read(parser->rb, 1);
+    parser->state = BL_PARSER_HUNT;
+}
+
+void bl_parser_init(bl_parser_t *parser, rb_t rb, bl_pool_t *pool,
+                    uint16_t max_payload, bl_parser_check_t check)
+{
+    memset(parser, 0, sizeof(*parser));
+
+    parser->rb = rb;
+    parser->pool = pool;
+    parser->check = check;
+    parser->state = BL_PARSER_HUNT;
+    bl_parser_set_max_payload(parser, max_payload);
+}
+
+/* 返回实际生效的值, 整帧必须能同时放进接收环和一个池块, 否则永远等不齐 */
+uint16_t bl_parser_set_max_payload(bl_parser_t *parser, uint16_t max_payload)
+{
+    uint32_t limit = rb_capacity(parser->rb) < parser->pool->slot_size ?
+                     rb_capacity(parser->rb) : parser->pool->slot_size;
+
+    if (max_payload + BL_FRAME_OVERHEAD > limit)
+        max_payload = limit - BL_FRAME_OVERHEAD;
+
+    parser->max_payload = max_payload;
+    return max_payload;
+}
+
+void bl_parser_error_callback_register(bl_parser_t *parser, bl_parser_error_t cb)
+{
+    parser->on_crc_error = cb;
+}
+
+bool bl_parser_poll(bl_parser_t *parser, bl_frame_t *frame)
+{
+    rb_t rb = parser->rb;
+
+    while (1)
+    {
+        switch (parser->state)
+        {
+            case BL_PARSER_HUNT:
+            {
+                const uint8_t *span;
+                uint32_t n = rb_peek_span(rb, 0, &span);
+                if (n == 0)
+                    return false;
+
+                const uint8_t *head = memchr(span, BL_FRAME_HEADER, n);
+                if (head == NULL)
+                {
+                    rb_commit_read(rb, n);
+                    break;
+                }
+
+                rb_commit_read(rb, head - span);
+                parser->state = BL_PARSER_HEAD;
+                break;
+            }
+            case BL_PARSER_HEAD:
+            {
+                uint8_t head[BL_FRAME_HEAD_LEN];
+
+                if (rb_count(rb) < BL_FRAME_HEAD_LEN)
+                    return false;
+
+                rb_peek(rb, 0, head, BL_FRAME_HEAD_LEN);
+                parser->opcode = head[1];
+                parser->length = (uint16_t)(head[3] << 8) | head[2];
+
+                if (parser->length > parser->max_payload ||
+                    (parser->check && !parser->check(parser->opcode, parser->length)))
+                {
+                    bl_parser_drop_header(parser);
+                    break;
+                }
+
+                parser->frame_len = parser->length + BL_FRAME_OVERHEAD;
+                crc16_init(&parser->crc);
+                crc16_update(&parser->crc, &head[1], BL_FRAME_HEAD_LEN - 1);
+                parser->crc_pos = BL_FRAME_HEAD_LEN;
+                parser->state = BL_PARSER_BODY;
+                break;
+            }
+            case BL_PARSER_BODY:
+            {
+                uint32_t count = rb_count(rb);
+                uint32_t crc_end = BL_FRAME_HEAD_LEN + parser->length;
+
+                /* 把新到的 payload 折算进 CRC, 最多两段 (环尾/环头) */
+                while (parser->crc_pos < crc_end && parser->crc_pos < count)
+                {
+                    const uint8_t *span;
+                    uint32_t n = rb_peek_span(rb, parser->crc_pos, &span);
+                    if (n > crc_end - parser->crc_pos)
+                        n = crc_end - parser->crc_pos;
+                    crc16_update(&parser->crc, span, n);
+                    parser->crc_pos += n;
+                }
+
+                if (count < parser->frame_len)
+                    return false;
+
+                /* 跨环尾的帧先借到块再校验, 池用尽时帧留在环里, 等有块归还 */
+                const uint8_t *base;
+                if (rb_peek_span(rb, 0, &base) < parser->frame_len)
+                {
+                    parser->slot = bl_pool_alloc(parser->pool);
+                    if (parser->slot == NULL)
+                        return false;
+                }
+
+                uint8_t pcrc[BL_FRAME_CRC_LEN];
+                rb_peek(rb, crc_end, pcrc, BL_FRAME_CRC_LEN);
+                uint16_t crc  = (uint16_t)(pcrc[1] << 8) | pcrc[0];
+                uint16_t ccrc = crc16_final(&parser->crc);
+                if (crc != ccrc)
+                {
+                    printf("crc err, opcode: 0x%02X, recv: 0x%04X, calc: 0x%04X\r\n", parser->opcode, crc, ccrc);
+                    bl_parser_put_slot(parser);
+                    bl_parser_drop_header(parser);
+                    if (parser->on_crc_error)
+                        parser->on_crc_error(parser->opcode, parser->length);
+                    break;
+                }
+
+                if (parser->slot != NULL)
+                {
+                    rb_peek(rb, 0, parser->slot, parser->frame_len);
+                    base = parser->slot;
+                }
+
+                parser->frame.opcode  = parser->opcode;
+                parser->frame.length  = parser->length;
+                parser->frame.payload = base + BL_FRAME_HEAD_LEN;
+                parser->state = BL_PARSER_READY;
+                break;
+            }
+            case BL_PARSER_READY:
+            {
+                *frame = parser->frame;
+                return true;
+            }
+            default:
+            {
+                parser->state = BL_PARSER_HUNT;
+                break;
+            }
+        }
+    }
+}
+
+void bl_parser_release(bl_parser_t *parser)
+{
+    if (parser->state != BL_PARSER_READY)
+        return ;
+
+    bl_parser_put_slot(parser);
+    rb_commit_read(parser->rb, parser->frame_len);
+    parser->state = BL_PARSER_HUNT;
+}
+
+/*
+ * 把当前帧转交给调用者: 帧已在池块中时直接交出该块, 否则借一块拷贝整帧,
+ * 然后释放环空间。frame 改为指向块内数据, 调用者用完后 bl_pool_free 归还返回的块。
+ * 池用尽时返回 NULL, 帧保持 READY, 调用者可稍后重试或照常 bl_parser_release。
+ */
+uint8_t *bl_parser_detach(bl_parser_t *parser, bl_frame_t *frame)
+{
+    if (parser->state != BL_PARSER_READY)
+        return NULL;
+
+    uint8_t *slot = parser->slot;
+    if (slot == NULL)
+    {
+        slot = bl_pool_alloc(parser->pool);
+        if (slot == NULL)
+            return NULL;
+        rb_peek(parser->rb, 0, slot, parser->frame_len);
+    }
+
+    parser->slot = NULL;
+    rb_commit_read(parser->rb, parser->frame_len);
+    parser->state = BL_PARSER_HUNT;
+
+    *frame = parser->frame;
+    frame->payload = slot + BL_FRAME_HEAD_LEN;
+    return slot;
+}
+
+/* 已收到帧头但帧还没收齐 */
+bool bl_parser_pending(const bl_parser_t *parser)
+{
+    return parser->state == BL_PARSER_HEAD || parser->state == BL_PARSER_BODY;
+}
+
+/* 接收超时: 丢弃当前帧头, 从后面的数据里重新找帧头 */
+void bl_parser_reset(bl_parser_t *parser)
+{
+    if (bl_parser_pending(parser))
+        bl_parser_drop_header(parser);
+}
+
+/* 丢弃所有已接收数据, 如波特率回退后环里的乱码 */
+void bl_parser_flush(bl_parser_t *parser)
+{
+    bl_parser_put_slot(parser);
+    rb_commit_read(parser->rb, rb_count(parser->rb));
+    parser->state = BL_PARSER_HUNT;
+}
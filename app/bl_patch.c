@@ -0,0 +1,177 @@
+#include <string.h>
+#include "bl_patch.h"
+
+void bl_patch_init(bl_patch_t *patch, const uint8_t *src, uint32_t src_size,
+                   uint8_t *buf, uint32_t buf_size, uint32_t limit, bl_patch_flush_t flush, void *arg)
+{
+    memset(patch, 0, sizeof(*patch));
+
+    patch->src = src;
+    patch->src_size = src_size;
+    patch->buf = buf;
+    patch->buf_size = buf_size;
+    patch->limit = limit;
+    patch->flush = flush;
+    patch->arg = arg;
+    patch->state = BL_PATCH_CTRL;
+}
+
+static bool bl_patch_fail(bl_patch_t *patch)
+{
+    patch->state = BL_PATCH_ERROR;
+    return false;
+}
+
+/* 缓冲写满时交给 flush */
+static bool bl_patch_flush_full(bl_patch_t *patch)
+{
+    if (patch->buf_len < patch->buf_size)
+        return true;
+
+    patch->buf_len = 0;
+    return patch->flush(patch->buf, patch->buf_size, patch->arg);
+}
+
+/* 控制字段读齐: 先检查整条记录不越界, 之后 DIFF/EXTRA 阶段无需再逐字节检查 */
+static bool bl_patch_ctrl_done(bl_patch_t *patch)
+{
+    uint32_t diff_len  = patch->ctrl[0];
+    uint32_t extra_len = patch->ctrl[1];
+    uint32_t zz = patch->ctrl[2];
+    int32_t seek = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+
+    if (diff_len > patch->src_size - patch->src_pos)
+        return false;
+    if (diff_len > patch->limit - patch->out_total ||
+        extra_len > patch->limit - patch->out_total - diff_len)
+        return false;
+
+    int64_t next = (int64_t)patch->src_pos + diff_len + seek;
+    if (next < 0 || next > (int64_t)patch->src_size)
+        return false;
+
+    patch->src_next = (uint32_t)next;
+
+    if (diff_len)
+        patch->state = BL_PATCH_DIFF;
+    else if (extra_len)
+        patch->state = BL_PATCH_EXTRA;
+    else
+    {
+        patch->src_pos = patch->src_next;
+        patch->state = BL_PATCH_CTRL;
+    }
+    return true;
+}
+
+bool bl_patch_feed(bl_patch_t *patch, const uint8_t *in, uint32_t length)
+{
+    const uint8_t *end = in + length;
+
+    while (in < end)
+    {
+        switch (patch->state)
+        {
+            case BL_PATCH_CTRL:
+            {
+                uint8_t b = *in++;
+
+                /* 第 5 字节只能带 4 位有效数据 */
+                if (patch->varint_len == BL_PATCH_VARINT_MAX - 1 && (b & 0xF0))
+                    return bl_patch_fail(patch);
+
+                patch->varint |= (uint32_t)(b & 0x7F) << (7 * patch->varint_len);
+                patch->varint_len++;
+                if (b & 0x80)
+                    break;
+
+                patch->ctrl[patch->field++] = patch->varint;
+                patch->varint = 0;
+                patch->varint_len = 0;
+                if (patch->field < 3)
+                    break;
+
+                patch->field = 0;
+                if (!bl_patch_ctrl_done(patch))
+                    return bl_patch_fail(patch);
+                break;
+            }
+            case BL_PATCH_DIFF:
+            {
+                uint32_t n = patch->buf_size - patch->buf_len;
+                if (n > patch->ctrl[0])
+                    n = patch->ctrl[0];
+                if (n > (uint32_t)(end - in))
+                    n = end - in;
+
+                const uint8_t *s = patch->src + patch->src_pos;
+                uint8_t *d = patch->buf + patch->buf_len;
+                for (uint32_t i = 0; i < n; i++)
+                    d[i] = (uint8_t)(s[i] + in[i]);
+
+                in += n;
+                patch->src_pos   += n;
+                patch->buf_len   += n;
+                patch->out_total += n;
+                patch->ctrl[0]   -= n;
+
+                if (!bl_patch_flush_full(patch))
+                    return bl_patch_fail(patch);
+
+                if (patch->ctrl[0] == 0)
+                {
+                    if (patch->ctrl[1])
+                        patch->state = BL_PATCH_EXTRA;
+                    else
+                    {
+                        patch->src_pos = patch->src_next;
+                        patch->state = BL_PATCH_CTRL;
+                    }
+                }
+                break;
+            }
+            case BL_PATCH_EXTRA:
+            {
+                uint32_t n = patch->buf_size - patch->buf_len;
+                if (n > patch->ctrl[1])
+                    n = patch->ctrl[1];
+                if (n > (uint32_t)(end - in))
+                    n = end - in;
+
+                memcpy(patch->buf + patch->buf_len, in, n);
+                in += n;
+                patch->buf_len   += n;
+                patch->out_total += n;
+                patch->ctrl[1]   -= n;
+
+                if (!bl_patch_flush_full(patch))
+                    return bl_patch_fail(patch);
+
+                if (patch->ctrl[1] == 0)
+                {
+                    patch->src_pos = patch->src_next;
+                    patch->state = BL_PATCH_CTRL;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* 输入结束: 必须停在记录边界, 再把缓冲中剩余的输出交给 flush */
+bool bl_patch_finish(bl_patch_t *patch)
+{
+    if (patch->state != BL_PATCH_CTRL || patch->field != 0 || patch->varint_len != 0)
+        return false;
+
+    if (patch->buf_len == 0)
+        return true;
+
+    uint32_t n = patch->buf_len;
+    patch->buf_len = 0;
+    return patch->flush(patch->buf, n, patch->arg);
+}
@@ -0,0 +1,76 @@
+#include <stddef.h>
+#include "stm32f4xx.h"
+#include "bl_pool.h"
+
+static inline uint32_t bl_pool_enter_critical(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static inline void bl_pool_exit_critical(uint32_t primask)
+{
+    __set_PRIMASK(primask);
+}
+
+void bl_pool_init(bl_pool_t *pool, uint32_t *storage, uint32_t slot_size, uint16_t slot_num)
+{
+    pool->base       = (uint8_t *)storage;
+    pool->slot_size  = BL_POOL_SLOT_ALIGN(slot_size);
+    pool->slot_num   = slot_num;
+    pool->used       = 0;
+    pool->high_water = 0;
+    pool->free_list  = NULL;
+
+    /* 倒序入链, 第一次分配得到第 0 块 */
+    for (uint16_t i = slot_num; i > 0; i--)
+    {
+        bl_pool_node_t *node = (bl_pool_node_t *)(pool->base + (uint32_t)(i - 1) * pool->slot_size);
+        node->next = pool->free_list;
+        pool->free_list = node;
+    }
+}
+
+/* 没有空闲块时返回 NULL, 调用者稍后重试 */
+void *bl_pool_alloc(bl_pool_t *pool)
+{
+    uint32_t primask = bl_pool_enter_critical();
+
+    bl_pool_node_t *node = pool->free_list;
+    if (node != NULL)
+    {
+        pool->free_list = node->next;
+        pool->used++;
+        if (pool->used > pool->high_water)
+            pool->high_water = pool->used;
+    }
+
+    bl_pool_exit_critical(primask);
+    return node;
+}
+
+void bl_pool_free(bl_pool_t *pool, void *slot)
+{
+    if (slot == NULL)
+        return ;
+
+    uint32_t primask = bl_pool_enter_critical();
+
+    bl_pool_node_t *node = (bl_pool_node_t *)slot;
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pool->used--;
+
+    bl_pool_exit_critical(primask);
+}
+
+uint16_t bl_pool_used(const bl_pool_t *pool)
+{
+    return pool->used;
+}
+
+uint16_t bl_pool_high_water(const bl_pool_t *pool)
+{
+    return pool->high_water;
+}
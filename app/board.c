@@ -1,9 +1,40 @@
 #include <stdio.h>
 #include "stm32f4xx.h"
 #include "board.h"
+#include "uart_tx.h"
+#include "main.h"
+
+#if BL_RUN_FROM_RAM
+/* SRAM 中的向量表; VTOR 要求按表大小向上取 2 的幂对齐, F40x 共 98 项, 取 128 项 512 字节 */
+#define BOARD_VECTOR_NUM        128
+
+extern const uint32_t __Vectors[];
+extern const uint8_t __Vectors_Size[];     // startup 中的 EQU 符号, 地址即大小
+
+static uint32_t board_ram_vectors[BOARD_VECTOR_NUM] __attribute__((aligned(BOARD_VECTOR_NUM * 4)));
+
+/* 在开任何中断之前调用, 此后取向量不再经过 flash */
+static void board_vector_relocate(void)
+{
+    uint32_t num = (uint32_t)__Vectors_Size / 4;
+
+    if (num > BOARD_VECTOR_NUM)
+        num = BOARD_VECTOR_NUM;
+
+    for (uint32_t i = 0; i < num; i++)
+        board_ram_vectors[i] = __Vectors[i];
+
+    __DSB();
+    SCB->VTOR = (uint32_t)board_ram_vectors;
+    __DSB();
+}
+#endif
 
 static void board_lowlevel_init(void)
 {
+#if BL_RUN_FROM_RAM
+    board_vector_relocate();
+#endif
     NVIC_PriorityGroupConfig(NVIC_PriorityGroup_4);
 
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA,  ENABLE);
@@ -11,6 +42,9 @@ static void board_lowlevel_init(void)
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOC,  ENABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD,  ENABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOE,  ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1,   ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2,   ENABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_CRC,    ENABLE);
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, ENABLE);
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
 
@@ -25,9 +59,17 @@ static void board_lowlevel_deinit(void)
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOC,  DISABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD,  DISABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOE,  DISABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1,   DISABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2,   DISABLE);
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_CRC,    DISABLE);
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, DISABLE);
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, DISABLE);
 
+#if BL_RUN_FROM_RAM
+    /* SRAM 中的向量表随时可能被 app 覆盖, 跳转前先指回 flash */
+    SCB->VTOR = FLASH_BASE;
+    __DSB();
+#endif
 }
 
 void board_init(void)
@@ -43,7 +85,8 @@ void board_deinit(void)
 
 int fputc(int ch, FILE *f)
 {
-    while (USART_GetFlagStatus(USART2, USART_FLAG_TXE) == RESET);
-    USART_SendData(USART2, (uint8_t) ch);
+    uint8_t c = (uint8_t)ch;
+
+    uart_tx_write(UART_PORT_DEBUG, &c, 1);
     return ch;
 }
@@ -1,13 +1,20 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include "main.h"
 #include "bootloader.h"
+#include "bl_parser.h"
+#include "bl_pool.h"
 #include "ringbuffer.h"
 #include "bl_uart.h"
 #include "crc16.h"
 #include "crc32.h"
 #include "flash_ops.h"
 #include "cpu_tick.h"
+#include "crc_hw.h"
+#include "bl_lz.h"
+#include "bl_patch.h"
 #include "stm32f4xx.h"
 
 /*
@@ -23,11 +30,115 @@
     opcode定义：
         0x10: 查询BOOT参数
         0x11: 进入主程序
+        0x12: 配置通信参数 (param + value)
         0x1F: 重启芯片
         0x20: 擦除指定区域内容
         0x21: 回读指定区域内容
         0x22: 将data写入addr地址
         0x23: 校验Flash内容
+        0x24: 带序号写入 (seq + addr + size + data), 可流水发送
+        0x25: 开始写入会话 (addr + size + crc32 + flags)
+        0x26: 会话数据 (seq + data), 地址隐式递增
+        0x27: 结束会话, 校验并写入arginfo
+        0x28: 查询分块 CRC32 清单 (addr + size + block)
+
+    0x10 查询参数：
+        0x00 版本 | major | minor |, 0x01 当前 MTU (2 byte),
+        0x02 能力 | opcodes(4) | mtu(2) | mtu_max(2) | window(1) | crc(1) | compress(1) |,
+        opcodes 第 n 位表示操作码 0x10 + n 可用, 由操作表 bl_op_table 生成,
+        window 为当前 MTU 下可协商的最大窗口。
+        0x03 帧缓冲池 | slots(1) | used(1) | high_water(1) | slot_size(2) |,
+        high_water 为启动以来同时占用块数的最大值, 用于评估池的大小是否合适。
+        0x04 启动 | listen_ms(2) | boot_us(4) | image(1) |, listen_ms 为自动跳转前的监听窗口,
+        boot_us 为最近一次自动跳转时从 main 到跳转的耗时, 从未自动跳转过时为 0,
+        image 为当前 arginfo 记录的状态: 0 无效, 1 待完整校验, 2 已完整校验。
+
+    启动策略 (见 bootloader.h):
+        上电后 arginfo 有效且镜像 CRC32 正确时, 监听 BL_BOOT_LISTEN_MS 后自动跳转到 app。
+        arginfo 记录带有校验状态: 完整校验过一次 (END/VERIFY 通过, 或启动时算过) 后,
+        之后的启动只检查向量表和镜像开头 ARGINFO_SAMPLE_SIZE 字节, 不再对整个镜像算 CRC32。
+        擦写 APP 区的命令 (0x20/0x22/0x24/0x25) 会把状态降回待校验, 下次启动重新完整校验;
+        主机可随时用 0x23 重新校验, app 也可写入 BL_BOOT_VERIFY_MAGIC 请求下次启动完整校验。
+        arginfo 的更新和 0x22 的编程都排进 flash 任务队列, 处理期间照常收发; 0x22 编程完成后才应答,
+        0x23/0x27 在新记录写入 flash 后才应答。
+        主机要进入升级模式, 须在复位后的监听窗口内发出帧头 0xAA (如连续发送 0xAA),
+        或由 app 写入升级请求后复位; 镜像无效时始终留在 bootloader。
+
+    0x12 波特率协商：
+        主机发送 | param=0x00 | baudrate(4 byte) |, 设备以旧波特率回 ACK 后切换,
+        主机需在 BL_BAUD_CONFIRM_TIMEOUT 内以新波特率发送 | param=0x01 |,
+        设备以新波特率回 ACK 表示确认, 超时未确认则退回旧波特率。
+        设备在第一个帧头 0xAA 上自动检测主机波特率; 之后接收空闲超过 BL_AUTOBAUD_IDLE_MS
+        或出现帧错误/噪声时重新检测, 主机改用其他波特率后只需重新发送帧头。
+        检测结果吸附到标准波特率或当前波特率, 因此协商得到的非标准波特率在重新检测后仍然可用。
+
+    0x21 回读：
+        主机发送 | addr(4) | size(4) |, 范围可以是整个片内 Flash。
+        设备不单独回 ACK, 而是按当前 MTU 切成多帧连续发出, 每帧 payload 为
+        | errcode | addr(4) | data |, data 直接由 DMA 从 Flash 发出, 不经 RAM 拷贝。
+        主机通过请求大小做流控: 最多可预先排队 BL_READ_QUEUE_DEPTH 个请求,
+        前一个请求发送期间下一个已在队列中, 链路不空闲; 队列满时回 | 0x02 |。
+        参数错误时回 | errcode |; 发送中途 DMA 发送不可用时, 补完当前帧后回 | 0xFF | 并丢弃排队的请求。
+
+    0x20 擦除：
+        主机发送 | addr(4) | size(4) |, 设备先检查每个重叠扇区, 已是全 0xFF 的跳过擦除,
+        回 | errcode | erased(2) | skipped(2) |, 按扇区号 (0~11) 置位; 参数错误时只回 | errcode |。
+        各扇区交给 flash 任务队列逐个擦除, 期间主循环照常收发, 全部擦完后才应答;
+        上一次区域擦除 (0x20 或 BEGIN bit0) 未完成时新的擦除请求暂缓处理。
+
+    0x28 分块清单：
+        主机发送 | addr(4) | size(4) | block(4) |, block 为 0 时按 flash 扇区划分 (首尾按区域裁剪),
+        否则为 4 的倍数且不小于 BL_MANIFEST_BLOCK_MIN。设备在主循环中逐块计算 CRC32 (同 0x23),
+        每攒够 BL_MANIFEST_BATCH 块 (受 MTU 限制) 或全部算完发一帧 | errcode | total(2) | first(2) | crc32(4) * n |,
+        total 为总块数, first 为本帧第一块的序号。主机据此只重发有变化或损坏的块。
+        已有清单在计算时回 | 0x02 |, 参数错误时回 | errcode |。
+
+    0x12 MTU 协商：
+        主机发送 | param=0x03 | mtu(2 byte) |, 设备回 | errcode | mtu(2 byte) |,
+        mtu 为单帧 payload 上限, 不超过 PACKET_PAYLOAD_MAX_LENGTH, 未协商时为 PACKET_PAYLOAD_DEFAULT_LENGTH。
+        大帧会减少窗口, 应先协商 MTU 再协商窗口。
+
+    0x12 窗口协商 / 0x24 流水写入：
+        主机发送 | param=0x02 | window(1 byte) | frame_payload(2 byte) |,
+        设备回 | errcode | window(1 byte) |, window 为按接收环容量裁剪后的窗口,
+        同时序号归零。之后主机最多可连续发出 window 个 0x24 帧而不等应答。
+        0x24 应答为 | errcode | next_seq(2 byte) |, next_seq 为下一个期望的序号,
+        即累积确认: next_seq 之前的帧均已写入。
+        errcode = 0x07 为 NAK (CRC 错误或序号跳跃), 主机应从 next_seq 起全部重发 (Go-Back-N),
+        同一个 next_seq 只 NAK 一次, 窗口内其余乱序帧静默丢弃。
+        重复帧 (序号小于 next_seq) 不再写入, 只重发确认。
+        0x24 和 0x26 的数据转存到帧缓冲池后交给 flash 任务队列, 由 FLASH 中断逐字 (x64 时逐双字) 编程, 编程完成后才确认;
+        其间主循环照常解析后续帧, 最多 BL_FRAME_POOL_SLOTS 帧同时在编程, 池或队列用尽时暂缓处理新帧。
+        因此 next_seq 只计入已写入的帧, 可能落后于已接收的帧; 重复帧的应答同样以已写入为准。
+        某帧编程失败时回 | 0xFF | next_seq(2) |, 其后已接收的帧作废, 主机从 next_seq 重发。
+
+    0x25/0x26/0x27 写入会话：
+        BEGIN | addr(4) | size(4) | crc32(4) | flags(1) | 一次性声明目标区域、总长度和整体CRC32,
+        flags bit0 置位时设备先擦除整个区域 (同 0x20, 在任务队列中进行, 擦完才应答和接受 DATA), 同时序号归零。
+        应答同 0x20 擦除: | errcode | erased(2) | skipped(2) |。
+        flags bit1 置位 (且 bit0 未置位) 为原地模式: 不预先擦除, 每个扇区由设备判断,
+        新数据是现有内容的位子集 ((old & new) == new) 时直接编程, 否则擦除该扇区并回
+        | 0x08 | next_seq(2) |, next_seq 为该扇区第一帧的序号, 主机须从这里重发 (可能早于已确认的序号)。
+        扇区只在整个落在会话区域内时才会被擦除; 否则擦除会丢掉主机不会重发的内容, 设备一个字也不写,
+        回 | 0x09 | next_seq(2) | 并结束会话, 由主机决定如何处理 (如回读整个扇区后以擦除模式重写)。
+        原地模式下 END 应答为 | errcode | erased(2) | inplace(2) |, 分别为擦除过和免擦除的扇区。
+        flags bit2 置位为压缩模式 (须同时置 bit0, 不能与原地模式同时使用): DATA 为 LZ4 block 格式的压缩流,
+        可在任意字节处切帧, 不要求 4 字节对齐; size 和 crc32 仍指解压后的镜像。设备边收边解压,
+        并对解压输出累加 CRC32; 输出攒进帧缓冲池的块中交给 flash 任务队列编程, DATA 的确认表示已解码,
+        擦写失败由之后的 DATA 或 END 以 0xFF 报告。
+        解压出错 (回 0x03) 后会话失效, 需重新 BEGIN。END 时先比较解压长度和累加的 CRC32, 再回读 flash 校验。
+        flags bit3 置位为差分模式 (须同时置 bit0, 可与 bit2 同时使用, 先解压再应用补丁), BEGIN 追加
+        | src_crc32(4) | staging(4) |: src_crc32 须与 arginfo 中当前镜像的 CRC32 相同, 否则回 0x04;
+        staging 为扇区起始地址, 位于当前镜像和目标区域之后, 且能放下 size 字节, 擦除的是 staging 区域。
+        DATA 为 tools/bl_patch.py 生成的补丁流, 设备以当前镜像为源边收边应用, 结果写入 staging,
+        源镜像在 END 之前不会被改动。END 时比较长度和 CRC32, 通过后作废 arginfo,
+        把 staging 拷贝到 addr, 再回读校验并写入 arginfo; 擦除和拷贝在任务队列中进行, 全部完成后才应答。
+        flags bit4 置位为自动擦除 (不能与 bit0/bit1 同时使用, 可代替 bit0 用于压缩/差分模式): BEGIN 不等擦除
+        立即应答, 每个扇区在第一次被写到时才擦除 (已是全 0xFF 的跳过), 并且在写当前扇区时
+        提前启动下一个扇区的擦除。END 应答为 | errcode | erased(2) | skipped(2) |。
+        DATA  | seq(2) | data | 写到 addr + 已写长度处, 应答和重传规则同 0x24,
+        除最后一帧外 data 长度须为 4 的倍数。
+        END 无 payload, 主机须等所有 DATA 确认后发送, 设备校验 CRC32 通过后写入 arginfo 再回 ACK。
 
     响应：
     | header | opcode | length | errcode | crc16
@@ -41,41 +152,93 @@
         0x03: 数据格式错误
         0x04: 校验失败
         0x05: 参数错误
+        0x07: 序号不连续, 需从 next_seq 重传
+        0x08: 原地模式下扇区已擦除, 需从 next_seq 重传
+        0x09: 原地模式下需要擦除的扇区超出会话区域, 未擦除, 会话结束
         0xFF: 未知错误
 
 */
 
 /* Flash 512k  bootloader: 48k  arginfo: 16k  app: */
+#define FLASH_START_ADDRESS         0x08000000
+#define FLASH_TOTAL_SIZE            (512 * 1024)
 #define ARGINFO_ADDRESS             0x0800C000
+#define ARGINFO_SIZE                (16 * 1024)     // 独占扇区 3
 #define APP_ADDRESS                 0x08010000
+#define APP_MAX_SIZE                ((512 - 64) * 1024)
 
 #define ARGINFO_HEADER              0x1A2B3C4D
 
+/*
+ * arginfo 日志: 记录依次追加在 arginfo 扇区中, 最后一条完整的记录为当前记录, 写满后擦除扇区从头写。
+ * 校验状态原地由 1 改写成 0 推进 (PENDING -> VALIDATED -> INVALID), 不需要擦除。
+ */
+#define ARGINFO_STATE_PENDING       0xFFFFFFFF      // 未完整校验, 启动时先对整个镜像算 CRC32
+#define ARGINFO_STATE_VALIDATED     0x5A5A5A5A      // 已完整校验, 启动时只做抽查
+#define ARGINFO_STATE_INVALID       0x00000000      // 已作废
+#define ARGINFO_SAMPLE_SIZE         512             // 抽查镜像开头 (向量表) 的字节数
+
 #define BOOTLOADER_VERSION_MAJOR    1
 #define BOOTLOADER_VERSION_MINOR    0
 
 /* rsp */
-#define RSP_ACK_LEN         7
+#define RSP_PAYLOAD_MAX_LEN 16
+#define RSP_MAX_LEN         (1 + 1 + 2 + RSP_PAYLOAD_MAX_LEN + 2)
 #define RSP_CRC_DATA_LEN    4
 #define RSP_CRC_START_POS   1
 
-/* ringbuffer */
-#define RINGBUFFER_LENGTH           1024
-#define PACKET_PAYLOAD_MAX_LENGTH   4096
+/* ringbuffer, 数据区必须为 2 的幂, 且能容纳一个最大帧; 环放在 CCM */
+#define RINGBUFFER_LENGTH           32768
+#define PACKET_PAYLOAD_MAX_LENGTH   16384   // 可协商的 MTU 上限
+#define PACKET_PAYLOAD_DEFAULT_LENGTH 4096  // 未协商时的 MTU
+#define PACKET_PAYLOAD_MIN_LENGTH   64      // 可协商的 MTU 下限, 回读帧头也要放得下
 #define PACKET_MAX_LENGTH           (1 + 1 + 2 + PACKET_PAYLOAD_MAX_LENGTH + 2)   // header + opcode + length + payload + crc
 
+/*
+ * 帧缓冲池: 每块放一个最大帧, 由跨环尾的帧、交给 flash 任务队列的流水帧和长应答共用。
+ * 发送 DMA 要访问, 不能放在 CCM。同时编程的流水帧数不超过块数。
+ */
+#define BL_FRAME_POOL_SLOTS          4
+
 #define PACKET_RECV_BYTE_TIMEOUT     2000
 
+#define BL_BAUD_CONFIRM_TIMEOUT      500
+
+#define BL_AUTOBAUD_IDLE_MS          1000    // 接收空闲超过该时间后重新检测波特率
+
+/* 启动策略使用的 RTC 备份寄存器, 系统复位后保持 */
+#define BL_BOOT_REQ_BKP              RTC_BKP_DR0     // app 写入 BL_BOOT_REQ_MAGIC 请求留在 bootloader
+#define BL_BOOT_TIME_BKP             RTC_BKP_DR1     // 最近一次自动跳转的耗时 (us)
+
+/* 流水写入窗口上限, 实际窗口还受接收环容量限制 */
+#define BL_WINDOW_MAX                16
+
+/* 回读: 可排队的请求数, 以及同时交给 DMA 的数据帧数 (双缓冲, 保证链路不空闲) */
+#define BL_READ_QUEUE_DEPTH          2
+#define BL_READ_INFLIGHT             2
+#define BL_READ_HEAD_LEN             5       // errcode + addr
+
+/* 分块清单: 每帧携带的块数, 以及按固定大小分块时的最小块 */
+#define BL_MANIFEST_BATCH            32
+#define BL_MANIFEST_BLOCK_MIN        256
+#define BL_MANIFEST_HEAD_LEN         5       // errcode + total + first
+
 typedef enum
 {
     BL_OPCODE_NONE      = 0x00,     // 未知类型, 异常处理
     BL_OPCODE_INQUERY   = 0x10,     // 查询BOOT参数
     BL_OPCODE_BOOT      = 0x11,     // 进入主程序
+    BL_OPCODE_SETUP     = 0x12,     // 配置通信参数
     BL_OPCODE_RESET     = 0x1F,     // 重启芯片
     BL_OPCODE_ERASE     = 0x20,     // 擦除指定区域内容
     BL_OPCODE_READ      = 0x21,     // 回读指定区域内容
     BL_OPCODE_WRITE     = 0x22,     // 将data写入addr地址
-    BL_OPCODE_VERIFY    = 0x23      // 校验Flash内容
+    BL_OPCODE_VERIFY    = 0x23,     // 校验Flash内容
+    BL_OPCODE_WRITE_SEQ = 0x24,     // 带序号写入, 滑动窗口
+    BL_OPCODE_BEGIN     = 0x25,     // 开始写入会话
+    BL_OPCODE_DATA      = 0x26,     // 会话数据
+    BL_OPCODE_END       = 0x27,     // 结束会话并校验
+    BL_OPCODE_MANIFEST  = 0x28      // 查询分块 CRC32 清单
 } bl_opcode_t;
 
 typedef enum
@@ -87,23 +250,134 @@ typedef enum
     BL_ERR_FORMAT,
     BL_ERR_VERIFY,
     BL_ERR_PARAM,
+    BL_ERR_SEQ,
+    BL_ERR_REWIND,
+    BL_ERR_NEED_ERASE,
     BL_ERR_UNKNOWN = 0xFF
 } bl_err_t;
 
 typedef enum
 {
-    BL_STATUS_HEADER,
-    BL_STATUS_OPCODE,
-    BL_STATUS_LENGTH,
-    BL_STATUS_PAYLOAD,
-    BL_STATUS_CRC
-} bl_status_t;
+    BL_INQUERY_PARAM_VERSION,
+    BL_INQUERY_PARAM_MIU,
+    BL_INQUERY_PARAM_CAPS,          // 能力位图和各项上限
+    BL_INQUERY_PARAM_POOL,          // 帧缓冲池占用和高水位
+    BL_INQUERY_PARAM_BOOT           // 监听窗口和最近一次自动跳转的耗时
+} bl_inquery_param_t;
+
+/* CAPS 应答中的 CRC 类型位 */
+#define BL_CAP_CRC_CRC16            (1 << 0)    // 帧校验 CRC16/XMODEM
+#define BL_CAP_CRC_CRC32            (1 << 1)    // 镜像校验 CRC32
+
+/* CAPS 应答中的压缩格式位 */
+#define BL_CAP_COMPRESS_NONE        0
+#define BL_CAP_COMPRESS_LZ          (1 << 0)    // LZ4 block, offset 不超过 BL_LZ_WINDOW_SIZE
+#define BL_CAP_COMPRESS_PATCH       (1 << 1)    // 以当前镜像为源的差分补丁
 
 typedef enum
 {
-    BL_INQUERY_PARAM_VERSION,
-    BL_INQUERY_PARAM_MIU
-} bl_inquery_param_t;
+    BL_SETUP_PARAM_BAUD,            // 提议新波特率
+    BL_SETUP_PARAM_BAUD_CONFIRM,    // 以新波特率确认
+    BL_SETUP_PARAM_WINDOW,          // 协商流水窗口
+    BL_SETUP_PARAM_MTU              // 协商单帧 payload 上限
+} bl_setup_param_t;
+
+#define BL_SESSION_FLAG_ERASE       (1 << 0)    // BEGIN 时擦除整个区域
+#define BL_SESSION_FLAG_INPLACE     (1 << 1)    // 按扇区判断能否免擦除原地编程
+#define BL_SESSION_FLAG_COMPRESS    (1 << 2)    // DATA 为压缩流, 须与 ERASE 同时使用
+#define BL_SESSION_FLAG_PATCH       (1 << 3)    // DATA 为差分补丁, 须与 ERASE 同时使用
+#define BL_SESSION_FLAG_AUTO_ERASE  (1 << 4)    // 扇区第一次被写到时擦除, 并预擦下一个扇区
+
+#define BL_BEGIN_LEN                13      // addr + size + crc + flags
+#define BL_BEGIN_PATCH_LEN          21      // 差分模式追加 src_crc32 + staging
+#define BL_PATCH_BUF_SIZE           1024    // 补丁输出缓冲, 满了才写 flash
+
+/* 一帧最多跨两个扇区: 两个擦除任务 + 一个编程任务, 队列空位不足时暂缓处理 */
+#define BL_DATA_JOBS_MAX            3
+
+/*
+ * 压缩/差分模式的输出先拷进池块, 攒满 BL_SESSION_OUT_SIZE (不超过最小扇区, 最多跨两个扇区)
+ * 再交给 flash 任务队列编程。最多占用 BL_SESSION_OUT_SLOTS 块: 一块在攒, 其余在编程。
+ */
+#define BL_SESSION_OUT_SIZE         (16 * 1024)
+#define BL_SESSION_OUT_SLOTS        2
+
+typedef struct
+{
+    bool active;
+    uint32_t addr;
+    uint32_t size;
+    uint32_t crc32;
+    uint32_t offset;        // 已写入长度, 下一帧写到 addr + offset; 压缩/差分模式下为已写入 out_addr 的输出长度
+
+    /*
+     * 原地模式: 每个扇区第一次被写到时记下回退点, 擦除后从这里重发; sector_pending 为正在擦除的冲突扇区。
+     * 自动擦除模式: sector_seen 为已可写 (擦除过或本来为空) 的扇区, sector_pending 为已排队擦除的扇区,
+     * erase_error 记录擦除任务失败, 由下一个完成的 DATA 帧报告。
+     */
+    bool inplace;
+    bool auto_erase;
+    bool erase_error;
+    uint16_t sector_pending;
+    uint16_t sector_seen;
+    uint16_t sector_erased;
+    uint16_t sector_seq[FLASH_SECTOR_NUM];
+    uint32_t sector_offset[FLASH_SECTOR_NUM];
+
+    /*
+     * 压缩/差分模式: 对最终输出累加 CRC32, END 时先与 crc32 比较。
+     * 输出攒在 out_slot 中, 编程异步进行, out_error 记录编程失败, 由下一次输出或 END 报告。
+     */
+    bool compress;
+    bool patch;
+    bool out_error;
+    uint32_t out_addr;      // 差分模式下为 staging, 否则同 addr
+    crc32_ctx_t out_crc;
+    uint8_t *out_slot;      // 正在攒输出的池块, 对应 [out_addr + offset - out_fill, out_addr + offset)
+    uint32_t out_fill;
+    uint8_t out_busy;       // 已提交编程、尚未完成的池块数
+} bl_session_t;
+
+typedef struct
+{
+    uint32_t addr;
+    uint32_t size;          // 剩余未发送长度
+} bl_read_req_t;
+
+typedef struct
+{
+    bool active;
+    bool pending;           // 一块的 CRC 正在计算
+    uint32_t addr;          // 下一块起始
+    uint32_t end;
+    uint32_t block;         // 0: 按扇区
+    uint16_t total;
+    uint16_t index;         // 下一块序号
+    uint16_t first;         // manifest_crc[0] 对应的块序号
+    uint8_t count;
+    uint32_t crc[BL_MANIFEST_BATCH];
+} bl_manifest_t;
+
+/* 异步校验任务, 完成后以 opcode 应答 */
+typedef struct
+{
+    uint8_t opcode;
+    uint32_t addr;
+    uint32_t size;
+    uint32_t crc32;
+    bool save_pending;      // 已通过校验, 等上一次 arginfo 更新完成后提交记录
+    bool saving;            // 记录已提交, 落盘后应答
+} bl_verify_t;
+
+/* 已交给 flash 任务队列、尚未确认的流水帧, 按提交顺序完成 */
+typedef struct
+{
+    uint8_t *slot;          // 帧所在的池块, 完成后归还
+    uint8_t opcode;
+    uint16_t seq;
+    uint16_t epoch;         // 提交时的 win_epoch, 不同时说明之后回退过, 该帧作废
+    uint32_t offset;        // DATA: 本帧在会话中的偏移, 失败时回退到这里
+} bl_inflight_t;
 
 typedef struct
 {
@@ -111,17 +385,161 @@ typedef struct
     uint32_t address;
     uint32_t length;
     uint32_t crc32;
+    uint32_t sample;        // 镜像开头 ARGINFO_SAMPLE_SIZE 字节的 CRC32
+    uint32_t check;         // 以上各字的 CRC32, 掉电写了一半的记录不会被当成有效
+    uint32_t state;         // ARGINFO_STATE_*
+    uint32_t reserved;      // 0xFFFFFFFF, 凑满 32 字节
 } bl_arginfo_t;
 
+#define ARGINFO_RECORD_NUM          (ARGINFO_SIZE / sizeof(bl_arginfo_t))
+
 static rb_t rx_rb;
-static uint8_t rx_rb_buf[RINGBUFFER_LENGTH];
-static uint8_t packet_buf[PACKET_MAX_LENGTH];
-static uint16_t packet_index = 0;
-static bl_status_t bl_status = BL_STATUS_HEADER;
+static uint32_t rx_rb_buf[RB_STORAGE_SIZE(RINGBUFFER_LENGTH) / 4] BL_CCM_DATA;  // 按字对齐
+static uint32_t rx_dropped = 0;
+static bl_parser_t parser;
+static bl_pool_t frame_pool;
+static uint32_t frame_pool_buf[BL_POOL_STORAGE_WORDS(PACKET_MAX_LENGTH, BL_FRAME_POOL_SLOTS)];
+
+/* 波特率协商: 切换后等待确认, 超时退回 baud_prev */
+static bool baud_pending = false;
+static uint32_t baud_prev = 0;
+static uint32_t boot_start_cycles = 0;     // 复位后的启动计时起点, 见 main()
+static uint64_t baud_switch_ticks = 0;
+
+/*
+ * 流水写入: win_expected 为下一个期望序号, 每个 win_expected 最多 NAK 一次;
+ * win_acked 为下一个待确认的序号, 两者之间是已接收但还在编程的帧。
+ * 回退时 win_epoch 加一, 回退前提交的帧完成后不再应答。
+ */
+static uint8_t win_size = 1;
+static uint16_t win_expected = 0;
+static uint16_t win_acked = 0;
+static uint16_t win_epoch = 0;
+static bool win_nak_sent = false;
+static bl_inflight_t inflight[BL_FRAME_POOL_SLOTS];
+static uint8_t inflight_head = 0;
+static uint8_t inflight_tail = 0;
+
+static bl_session_t session;
+
+/*
+ * 区域擦除 (0x20 和 BEGIN bit0): 逐扇区提交到 flash 任务队列, 随队列空位补交,
+ * 最后一个扇区回调时应答。同一时间只进行一个。
+ */
+typedef struct
+{
+    bool active;
+    bool fail;
+    uint8_t opcode;
+    int8_t next;            // 下一个待提交的扇区
+    int8_t last;
+    uint8_t pending;        // 已提交未回调的扇区数
+    flash_erase_report_t report;
+} bl_erase_job_t;
+
+static bl_erase_job_t erase_job;
+
+/* 本次运行中已把当前记录降回待校验, 下一次写 arginfo 之前不必重复 */
+static bool arginfo_touched = false;
+
+/*
+ * arginfo 更新交给 flash 任务队列, 与 APP 区的擦写按提交顺序进行。同一时间只有一次更新,
+ * 新记录和状态字留在这里直到任务完成; arginfo_jobs 为已提交未回调的任务数。
+ */
+typedef void (*bl_arginfo_cb_t)(bool ok);
+
+#define ARGINFO_JOBS_MAX            3       // 作废当前记录 + 擦除扇区 + 写新记录
+
+static bl_arginfo_t arginfo_record;
+static uint32_t arginfo_state;
+static uint8_t arginfo_jobs = 0;
+static bool arginfo_fail = false;
+static bl_arginfo_cb_t arginfo_done_cb = NULL;
+
+/* 池块或任务队列空位不足时置 frame_retry, 帧留在接收环中, 主循环下一轮重新处理同一帧 */
+static bool frame_retry = false;
+static bl_lz_t session_lz;
+static uint8_t session_lz_window[BL_LZ_WINDOW_SIZE] BL_CCM_DATA;  // 只由 CPU 读写, 可以放在 CCM
+static bl_patch_t session_patch;
+static uint8_t session_patch_buf[BL_PATCH_BUF_SIZE] BL_CCM_DATA;
+static bl_verify_t verify_job;
+static bl_manifest_t manifest;
+
+/* 回读队列只在主循环中操作; 帧完成计数在 DMA 中断中递增 */
+static bl_read_req_t read_queue[BL_READ_QUEUE_DEPTH];
+static uint8_t read_head = 0;
+static uint8_t read_tail = 0;
+static uint32_t read_frames_queued = 0;
+static volatile uint32_t read_frames_done = 0;
 
-static inline uint32_t get_u32_le_inc(uint8_t **p)
+typedef enum
+{
+    BL_SEQ_NEW,         // 正是期望的帧
+    BL_SEQ_DUP,         // 已处理过的重复帧
+    BL_SEQ_GAP          // 前面有帧丢失
+} bl_seq_state_t;
+
+/* 操作表: 帧头阶段据此过滤, 收齐后据此分发 */
+typedef void (*bl_op_handler_t)(const bl_frame_t *frame);
+
+#define BL_OP_FLAG_SEQ              (1 << 0)    // 带序号, 走窗口确认和 NAK 重传
+
+#define BL_OP_LEN_ANY               0xFFFF      // 不限制 payload 长度
+
+typedef struct
+{
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t min_len;
+    uint16_t max_len;
+    bl_op_handler_t handler;
+} bl_op_entry_t;
+
+static void bl_op_inquery_handle(const bl_frame_t *frame);
+static void bl_op_boot_handle(const bl_frame_t *frame);
+static void bl_op_setup_handle(const bl_frame_t *frame);
+static void bl_op_reset_handle(const bl_frame_t *frame);
+static void bl_op_erase_handle(const bl_frame_t *frame);
+static void bl_op_write_handle(const bl_frame_t *frame);
+static void bl_op_read_handle(const bl_frame_t *frame);
+static void bl_op_verify_handle(const bl_frame_t *frame);
+static void bl_op_write_seq_handle(const bl_frame_t *frame);
+static void bl_op_begin_handle(const bl_frame_t *frame);
+static void bl_op_data_handle(const bl_frame_t *frame);
+static void bl_op_end_handle(const bl_frame_t *frame);
+static void bl_op_manifest_handle(const bl_frame_t *frame);
+
+static const bl_op_entry_t bl_op_table[] =
 {
-    uint8_t *ptr = *p;
+    /* opcode               flags           min  max                         handler */
+    {BL_OPCODE_INQUERY,     0,              1,   1,                          bl_op_inquery_handle},
+    {BL_OPCODE_BOOT,        0,              0,   BL_OP_LEN_ANY,              bl_op_boot_handle},
+    {BL_OPCODE_SETUP,       0,              1,   5,                          bl_op_setup_handle},
+    {BL_OPCODE_RESET,       0,              0,   BL_OP_LEN_ANY,              bl_op_reset_handle},
+    {BL_OPCODE_ERASE,       0,              8,   8,                          bl_op_erase_handle},
+    {BL_OPCODE_READ,        0,              8,   8,                          bl_op_read_handle},
+    {BL_OPCODE_WRITE,       0,              9,   PACKET_PAYLOAD_MAX_LENGTH,  bl_op_write_handle},
+    {BL_OPCODE_VERIFY,      0,              12,  12,                         bl_op_verify_handle},
+    {BL_OPCODE_WRITE_SEQ,   BL_OP_FLAG_SEQ, 11,  PACKET_PAYLOAD_MAX_LENGTH,  bl_op_write_seq_handle},
+    {BL_OPCODE_BEGIN,       0,              13,  21,                         bl_op_begin_handle},
+    {BL_OPCODE_DATA,        BL_OP_FLAG_SEQ, 3,   PACKET_PAYLOAD_MAX_LENGTH,  bl_op_data_handle},
+    {BL_OPCODE_END,         0,              0,   0,                          bl_op_end_handle},
+    {BL_OPCODE_MANIFEST,    0,              12,  12,                         bl_op_manifest_handle},
+};
+
+static const bl_op_entry_t *bl_op_find(uint8_t opcode)
+{
+    for (uint8_t i = 0; i < ARRAY_SIZE(bl_op_table); i++)
+    {
+        if (bl_op_table[i].opcode == opcode)
+            return &bl_op_table[i];
+    }
+    return NULL;
+}
+
+static inline uint32_t get_u32_le_inc(const uint8_t **p)
+{
+    const uint8_t *ptr = *p;
     uint32_t val = ((uint32_t)ptr[0])       |
                    ((uint32_t)ptr[1] << 8)  |
                    ((uint32_t)ptr[2] << 16) |
@@ -130,16 +548,16 @@ static inline uint32_t get_u32_le_inc(uint8_t **p)
     return val;
 }
 
-static inline uint16_t get_u16_le_inc(uint8_t **p)
+static inline uint16_t get_u16_le_inc(const uint8_t **p)
 {
-    uint8_t *ptr = *p;
+    const uint8_t *ptr = *p;
     uint16_t val = ((uint16_t)ptr[0]) |
                    ((uint16_t)ptr[1] << 8);
     *p += 2;
     return val;
 }
 
-static inline uint8_t get_u8_le_inc(uint8_t **p)
+static inline uint8_t get_u8_le_inc(const uint8_t **p)
 {
     uint8_t val = **p;
     *p += 1;
@@ -151,21 +569,26 @@ static inline uint8_t get_u8(const uint8_t *p, int i)
     return p[i];
 }
 
-static void bl_uart_recv_cb(uint8_t data)
+static void bl_uart_recv_cb(const uint8_t *data, uint16_t length)
 {
-    rb_write(rx_rb, data);
+    rx_dropped += length - rb_write_block(rx_rb, data, length);
 }
 
-static void bl_packet_reset(void)
+/* 帧头阶段只拦截未知操作码和超长帧, 过短的帧留给分发时回 FORMAT */
+static bool bl_opcode_check(uint8_t opcode, uint16_t length)
 {
-    packet_index = 0;
-    bl_status = BL_STATUS_HEADER;
+    const bl_op_entry_t *op = bl_op_find(opcode);
+
+    return op != NULL && length <= op->max_len;
 }
 
 static void bl_response(uint8_t opcode, uint16_t length, uint8_t* data)
 {
     uint8_t index = 0;
-    uint8_t rsp_buf[RSP_ACK_LEN];
+    uint8_t rsp_buf[RSP_MAX_LEN];
+
+    if (length > RSP_PAYLOAD_MAX_LEN)
+        return ;
 
     rsp_buf[index++] = 0xAA;              // 0: Header (AA)
     rsp_buf[index++] = opcode;            // 1: Opcode
@@ -182,12 +605,64 @@ static void bl_response(uint8_t opcode, uint16_t length, uint8_t* data)
     bl_uart_send(rsp_buf, index);
 }
 
+/* DMA 中断上下文: 长应答发送完成, 归还池块 */
+static void bl_response_long_done_cb(void *arg)
+{
+    bl_pool_free(&frame_pool, arg);
+}
+
+/*
+ * 超过 rsp_buf 的应答: 整帧拼进一个池块后零拷贝交给发送 DMA, 完成后归还;
+ * 没有空闲块时帧头和 payload 分段送入发送 FIFO。CRC 逐段累加。
+ */
+static void bl_response_long(uint8_t opcode, const uint8_t *head, uint16_t head_len,
+                             const uint8_t *data, uint16_t data_len)
+{
+    uint16_t length = head_len + data_len;
+    uint8_t frame_head[BL_FRAME_HEAD_LEN];
+    uint8_t frame_tail[BL_FRAME_CRC_LEN];
+    crc16_ctx_t ctx;
+
+    frame_head[0] = BL_FRAME_HEADER;
+    frame_head[1] = opcode;
+    frame_head[2] = (uint8_t)(length & 0xFF);
+    frame_head[3] = (uint8_t)(length >> 8);
+
+    crc16_init(&ctx);
+    crc16_update(&ctx, &frame_head[1], sizeof(frame_head) - 1);
+    crc16_update(&ctx, head, head_len);
+    crc16_update(&ctx, data, data_len);
+    uint16_t crc = crc16_final(&ctx);
+
+    frame_tail[0] = (uint8_t)(crc & 0xFF);
+    frame_tail[1] = (uint8_t)(crc >> 8);
+
+    uint8_t *slot = (length + BL_FRAME_OVERHEAD <= frame_pool.slot_size) ? bl_pool_alloc(&frame_pool) : NULL;
+    if (slot != NULL)
+    {
+        uint8_t *p = slot;
+        memcpy(p, frame_head, sizeof(frame_head));  p += sizeof(frame_head);
+        memcpy(p, head, head_len);                  p += head_len;
+        memcpy(p, data, data_len);                  p += data_len;
+        memcpy(p, frame_tail, sizeof(frame_tail));  p += sizeof(frame_tail);
+
+        if (bl_uart_send_async(slot, (uint16_t)(p - slot), bl_response_long_done_cb, slot))
+            return ;
+        bl_pool_free(&frame_pool, slot);
+    }
+
+    bl_uart_send(frame_head, sizeof(frame_head));
+    bl_uart_send((uint8_t *)head, head_len);
+    bl_uart_send((uint8_t *)data, data_len);
+    bl_uart_send(frame_tail, sizeof(frame_tail));
+}
+
 static void bl_response_ack(uint8_t opcode, uint16_t length, uint8_t errcode)
 {
 
     bl_response(opcode, 1, &errcode);
     // uint8_t index = 0;
-    // uint8_t rsp_buf[RSP_ACK_LEN];
+    // uint8_t rsp_buf[RSP_MAX_LEN];
 
     // rsp_buf[index++] = 0xAA;              // 0: Header (AA)
     // rsp_buf[index++] = opcode;            // 1: Opcode
@@ -204,364 +679,1961 @@ static void bl_response_ack(uint8_t opcode, uint16_t length, uint8_t errcode)
     // bl_uart_send(rsp_buf, index);
 }
 
-static bool bl_recv_handle(uint8_t byte)
+/* [addr, addr + size) 必须落在 APP 区内, 写法避免加法溢出 */
+static bool bl_app_region_valid(uint32_t addr, uint32_t size)
 {
-    static uint16_t length = 0;
-    static uint16_t recv_len = 0;
-    bool pkt_full = false;
-    packet_buf[packet_index++] = byte;
-
-    switch (bl_status)
-    {
-        case BL_STATUS_HEADER:
-        {
-            recv_len = 0;
-
-            printf("header\r\n");
-            if (byte == 0xAA)   bl_status = BL_STATUS_OPCODE;
-            else                bl_packet_reset();
-            break;
-        }
-        case BL_STATUS_OPCODE:
-        {
-            printf("opcode\r\n");
+    return addr >= APP_ADDRESS && size != 0 && size <= APP_MAX_SIZE &&
+           addr - APP_ADDRESS <= APP_MAX_SIZE - size;
+}
 
-            if (byte == BL_OPCODE_BOOT || byte == BL_OPCODE_RESET ||
-                byte == BL_OPCODE_ERASE || byte == BL_OPCODE_READ ||
-                byte == BL_OPCODE_WRITE || byte == BL_OPCODE_VERIFY ||
-                byte == BL_OPCODE_INQUERY)
-            {
-                bl_status = BL_STATUS_LENGTH;
-            }
-            else
-            {
-                printf("unknown opcode: 0x%02X\r\n", byte);
-                bl_packet_reset();
-            }
-            break;
-        }
-        case BL_STATUS_LENGTH:
-        {
-            printf("length\r\n");
-            recv_len++;
-            if (recv_len == 2)
-            {
-                length = (packet_buf[3] << 8) | packet_buf[2];  //big endian
-                printf("length: %d\r\n", length);
-
-                if (length > PACKET_PAYLOAD_MAX_LENGTH)
-                {
-                    printf("length overflow\r\n");
-                    length = 0;
-                    bl_packet_reset();
-                }
-                else if (length == 0)
-                {
-                    bl_status = BL_STATUS_CRC;
-                }
-                else
-                {
-                    bl_status = BL_STATUS_PAYLOAD;
-                }
-                recv_len = 0;
-            }
-            break;
-        }
-        case BL_STATUS_PAYLOAD:
-        {
-            printf("payload\r\n");
+/* [addr, addr + size) 必须落在片内 Flash 内 */
+static bool bl_flash_region_valid(uint32_t addr, uint32_t size)
+{
+    return addr >= FLASH_START_ADDRESS && size != 0 && size <= FLASH_TOTAL_SIZE &&
+           addr - FLASH_START_ADDRESS <= FLASH_TOTAL_SIZE - size;
+}
 
-            recv_len++;
-            if (recv_len == length)
-            {
-                bl_status = BL_STATUS_CRC;
-                recv_len = 0;
-            }
-            break;
-        }
-        case BL_STATUS_CRC:
-        {
-            printf("crc\r\n");
+static const bl_arginfo_t *bl_arginfo_slot(uint32_t index)
+{
+    return (const bl_arginfo_t *)ARGINFO_ADDRESS + index;
+}
 
-            recv_len++;
+/* 第一条空记录的序号。记录按顺序追加且从首字开始编程, 非空记录总在空记录之前, 可以二分查找 */
+static uint32_t bl_arginfo_end(void)
+{
+    uint32_t lo = 0, hi = ARGINFO_RECORD_NUM;
 
-            if (recv_len == 2)
-            {
-                uint16_t crc  = packet_buf[packet_index - 1] << 8 | packet_buf[packet_index - 2];
-                uint16_t ccrc = crc16(&packet_buf[1], length + 3);
-                if (crc == ccrc)
-                {
-                    printf("crc ok\r\n");
-                    pkt_full = true;
-                }
-                else
-                {
-                    printf("crc err, recv: 0x%04X, calc: 0x%04X\r\n", crc, ccrc);
-                }
-
-                recv_len = 0;
-                length = 0;
-            }
-            break;
-        }
-        default:
-        {
-            printf("unknown status\r\n");
-            recv_len = 0;
-            length = 0;
-            break;
-        }
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (bl_arginfo_slot(mid)->magic_head == 0xFFFFFFFF)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
-    return pkt_full;
+    return lo;
 }
 
-static void bl_op_inquery_handle(void)
+static uint32_t bl_arginfo_check(const bl_arginfo_t *arginfo)
 {
-    printf("bl_op_inquery_handle\r\n");
-
-    uint8_t opcode = packet_buf[1];
-    uint8_t param = packet_buf[4];
+    return crc32((const uint8_t *)arginfo, offsetof(bl_arginfo_t, check));
+}
 
-    if (opcode != BL_OPCODE_INQUERY)
-        return ;
+/* 当前记录, 没有时返回 NULL。只有最后一条可能写了一半, 此时退回前一条 (追加前已被作废) */
+static const bl_arginfo_t *bl_arginfo_current(void)
+{
+    uint32_t end = bl_arginfo_end();
 
-    switch (param)
+    for (uint32_t i = end; i > 0 && end - i < 2; i--)
     {
-        case BL_INQUERY_PARAM_VERSION:
-        {
-            uint8_t version[2] = {BOOTLOADER_VERSION_MAJOR, BOOTLOADER_VERSION_MINOR};
-            bl_response(opcode, sizeof(version), version);
-            break;
-        }
-        case BL_INQUERY_PARAM_MIU:
-        {
-            uint16_t mtu = PACKET_PAYLOAD_MAX_LENGTH;
-            bl_response(opcode, sizeof(mtu), (uint8_t *)&mtu);
-            break;
-        }
+        const bl_arginfo_t *arginfo = bl_arginfo_slot(i - 1);
+        if (arginfo->magic_head == ARGINFO_HEADER && arginfo->check == bl_arginfo_check(arginfo))
+            return arginfo;
     }
+    return NULL;
 }
 
-static void bl_op_boot_handle(void)
+/* 当前记录有效且描述的是 APP 区内的镜像 */
+static const bl_arginfo_t *bl_arginfo_image(void)
 {
-    extern void jump_to_app(uint32_t app_add);
+    const bl_arginfo_t *arginfo = bl_arginfo_current();
 
-    /* deinit usart, systick */
-    extern void uart_deinit(void);
-    extern void board_deinit(void);
-    extern void cpu_tick_deinit(void);
+    if (arginfo == NULL || arginfo->state == ARGINFO_STATE_INVALID ||
+        !bl_app_region_valid(arginfo->address, arginfo->length))
+        return NULL;
+    return arginfo;
+}
 
-    bl_response_ack(BL_OPCODE_BOOT, 1, BL_ERR_OK);
+/* 状态只能由 1 改写成 0, 直接编程记录中的 state 字; 启动检查时任务队列还没启动, 同步写入 */
+static bool bl_arginfo_set_state_sync(const bl_arginfo_t *arginfo, uint32_t state)
+{
+    return flash_write((uint32_t)&arginfo->state, (const uint8_t *)&state, sizeof(state));
+}
 
-    cpu_tick_deinit();
-    uart_deinit();
-    board_deinit();
+/* 一次 arginfo 更新的任务完成 (主循环), 最后一个完成时回调 arginfo_done_cb */
+static void bl_arginfo_job_cb(flash_job_status_t status, void *arg)
+{
+    (void)arg;
 
-    jump_to_app(APP_ADDRESS);
+    if (status == FLASH_JOB_FAIL)
+        arginfo_fail = true;
+    if (--arginfo_jobs > 0)
+        return ;
+
+    if (arginfo_fail)
+        printf("arginfo update failed\r\n");
+
+    bl_arginfo_cb_t cb = arginfo_done_cb;
+    arginfo_done_cb = NULL;
+    if (cb)
+        cb(!arginfo_fail);
 }
 
-static void bl_op_reset_handle(void)
+/* 上一次更新已完成, 且队列除本次更新外还能给调用者留一个空位 */
+static bool bl_arginfo_ready(void)
 {
-    bl_response_ack(BL_OPCODE_RESET, 1, BL_ERR_OK);
-    __disable_irq();
-    NVIC_SystemReset();
+    return arginfo_jobs == 0 && flash_job_space() > ARGINFO_JOBS_MAX;
 }
 
-static void bl_op_erase_handle(void)
+static bool bl_arginfo_set_state(const bl_arginfo_t *arginfo, uint32_t state)
 {
-    /* param: addr size -- 8 bytes */
-    uint8_t *pbuf = &packet_buf[2];
-    uint16_t length = get_u16_le_inc(&pbuf);
-    if (length != 8)
+    arginfo_state = state;
+    if (!flash_job_program((uint32_t)&arginfo->state, (const uint8_t *)&arginfo_state, sizeof(arginfo_state),
+                           bl_arginfo_job_cb, NULL))
+        return false;
+    arginfo_jobs++;
+    return true;
+}
+
+/*
+ * 先作废当前记录再追加, 追加时掉电不会退回到旧记录; 扇区写满时擦除后从头写。
+ * 调用者须先确认 bl_arginfo_ready。返回 false 表示一个任务也没提交, cb 不会被调用
+ */
+static bool bl_arginfo_append(const bl_arginfo_t *arginfo, bl_arginfo_cb_t cb)
+{
+    const bl_arginfo_t *cur = bl_arginfo_current();
+    uint32_t end = bl_arginfo_end();
+    bool ok = true;
+
+    arginfo_record = *arginfo;
+    arginfo_record.magic_head = ARGINFO_HEADER;
+    arginfo_record.reserved   = 0xFFFFFFFF;
+    arginfo_record.check      = bl_arginfo_check(&arginfo_record);
+    arginfo_fail    = false;
+    arginfo_done_cb = cb;
+
+    if (cur != NULL && cur->state != ARGINFO_STATE_INVALID)
+        ok = bl_arginfo_set_state(cur, ARGINFO_STATE_INVALID);
+
+    if (ok && end == ARGINFO_RECORD_NUM)
     {
-        bl_response_ack(BL_OPCODE_ERASE, 1, BL_ERR_FORMAT);
-        return ;
+        ok = flash_job_erase(flash_sector_index(ARGINFO_ADDRESS), bl_arginfo_job_cb, NULL);
+        if (ok)
+            arginfo_jobs++;
+        end = 0;
     }
 
-    uint8_t *pbuf = &packet_buf[4];
-    uint32_t addr = get_u32_le_inc(&pbuf);
-    uint32_t size = get_u32_le_inc(&pbuf);
-
-    if (addr < APP_ADDRESS || size == 0 ||
-        (addr + size) > (APP_ADDRESS + (512 - 64) * 1024))
+    if (ok)
     {
-        bl_response_ack(BL_OPCODE_ERASE, 1, BL_ERR_PARAM);
-        return ;
+        ok = flash_job_program((uint32_t)bl_arginfo_slot(end), (const uint8_t *)&arginfo_record,
+                               sizeof(arginfo_record), bl_arginfo_job_cb, NULL);
+        if (ok)
+            arginfo_jobs++;
     }
 
-    if (flash_erase(addr, size))
-        bl_response_ack(BL_OPCODE_ERASE, 1, BL_ERR_OK);
-    else
-        bl_response_ack(BL_OPCODE_ERASE, 1, BL_ERR_UNKNOWN);
+    /* 已提交的任务完成后按失败回调 */
+    if (!ok)
+        arginfo_fail = true;
+    if (arginfo_jobs == 0)
+        arginfo_done_cb = NULL;
+    return arginfo_jobs > 0;
 }
 
-static void bl_op_write_handle(void)
+/* 记录刚经过完整校验的镜像, 落盘后回调 cb。调用者须先确认 bl_arginfo_ready */
+static bool bl_arginfo_save(uint32_t addr, uint32_t size, uint32_t crc, bl_arginfo_cb_t cb)
 {
-    uint8_t *pbuf = &packet_buf[2];
-    uint16_t length = get_u16_le_inc(&pbuf);
+    bl_arginfo_t arginfo;
 
-    if (length <= 8)
-    {
-        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_FORMAT);
-        return ;
-    }
+    arginfo.address = addr;
+    arginfo.length  = size;
+    arginfo.crc32   = crc;
+    arginfo.sample  = crc32((const uint8_t *)addr, size < ARGINFO_SAMPLE_SIZE ? size : ARGINFO_SAMPLE_SIZE);
+    arginfo.state   = ARGINFO_STATE_VALIDATED;
 
-    uint32_t addr = get_u32_le_inc(&pbuf);
-    uint32_t size = get_u32_le_inc(&pbuf);
+    arginfo_touched = false;
+    return bl_arginfo_append(&arginfo, cb);
+}
 
-    if (addr < APP_ADDRESS || size == 0 ||
-        (addr + size) > (APP_ADDRESS + (512 - 64) * 1024))
-    {
-        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_PARAM);
-        return ;
-    }
+/*
+ * 即将擦写 APP 区: 已校验的记录降回待校验, 下次启动重新对整个镜像算 CRC32。
+ * 降级任务排在随后提交的擦写任务之前。上一次更新未完成或队列空位不足时返回 false, 调用者稍后重试
+ */
+static bool bl_arginfo_touch(void)
+{
+    if (arginfo_touched)
+        return true;
+    if (!bl_arginfo_ready())
+        return false;
+    arginfo_touched = true;
+
+    const bl_arginfo_t *cur = bl_arginfo_current();
+    if (cur == NULL || cur->state != ARGINFO_STATE_VALIDATED)
+        return true;
+
+    bl_arginfo_t arginfo = *cur;
+    arginfo.state = ARGINFO_STATE_PENDING;
+    bl_arginfo_append(&arginfo, NULL);
+    return true;
+}
 
-    if (flash_write(addr, pbuf, size))
-        bl_response_ack(BL_OPCODE_WRITE, 1, BL_ERR_OK);
-    else
-        bl_response_ack(BL_OPCODE_WRITE, 1, BL_ERR_UNKNOWN);
+/* 作废当前记录, 下次启动停在 bootloader。条件同 bl_arginfo_touch */
+static bool bl_arginfo_invalidate(void)
+{
+    if (!bl_arginfo_ready())
+        return false;
+
+    const bl_arginfo_t *cur = bl_arginfo_current();
+    arginfo_fail    = false;
+    arginfo_done_cb = NULL;
+    if (cur != NULL && cur->state != ARGINFO_STATE_INVALID)
+        bl_arginfo_set_state(cur, ARGINFO_STATE_INVALID);
+    return true;
 }
 
-static void bl_op_verify_handle(void)
+/* 流水帧应答: errcode + 序号。确认只报告已写入的帧, NAK 报告下一个期望接收的帧 */
+static void bl_seq_response(uint8_t opcode, uint8_t errcode)
 {
-    /* param: add size crc --- 12 bytes */
-    uint8_t *pbuf = &packet_buf[2];
-    uint16_t length = get_u16_le_inc(&pbuf);
+    uint16_t next = (errcode == BL_ERR_OK) ? win_acked : win_expected;
+    uint8_t rsp[3] = {errcode, (uint8_t)(next & 0xFF), (uint8_t)(next >> 8)};
 
-    if (length != 12)
-    {
-        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_FORMAT);
+    bl_response(opcode, sizeof(rsp), rsp);
+}
+
+/* 拒绝当前帧, 窗口内后续帧静默丢弃, 直到主机从 win_expected 重发 */
+static void bl_seq_reject(uint8_t opcode, uint8_t errcode)
+{
+    if (win_nak_sent)
         return ;
-    }
 
-    uint32_t vaddr  = get_u32_le_inc(&pbuf);
-    uint32_t vsize  = get_u32_le_inc(&pbuf);
-    uint32_t vcrc32 = get_u32_le_inc(&pbuf);
+    win_nak_sent = true;
+    bl_seq_response(opcode, errcode);
+}
 
-    if (vaddr < APP_ADDRESS || vsize == 0 ||
-        (vaddr + vsize) > (APP_ADDRESS + (512 - 64) * 1024))
-    {
-        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_PARAM);
-        return ;
-    }
+/* 从 seq 起重新接收, 已提交但未完成的帧完成后不再应答 */
+static void bl_seq_rewind(uint16_t seq)
+{
+    win_expected = seq;
+    win_acked    = seq;
+    win_nak_sent = false;
+    win_epoch++;
+}
+
+static void bl_seq_reset(void)
+{
+    bl_seq_rewind(0);
+}
 
-    uint32_t ccrc = crc32((const unsigned char *)vaddr, vsize);
+/* 序号按 16 位回绕比较 */
+static bl_seq_state_t bl_seq_check(uint16_t seq)
+{
+    int16_t diff = (int16_t)(seq - win_expected);
 
-    if (ccrc == vcrc32)
-    {
-        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_OK);
+    if (diff == 0)
+        return BL_SEQ_NEW;
+    return diff < 0 ? BL_SEQ_DUP : BL_SEQ_GAP;
+}
 
-        // 校验通过，写入arginfo
-        bl_arginfo_t arginfo;
+/* 同步处理完一帧, 调用时不能有未完成的帧 */
+static void bl_seq_advance(void)
+{
+    win_expected++;
+    win_acked = win_expected;
+    win_nak_sent = false;
+}
 
-        arginfo.magic_head = ARGINFO_HEADER;
-        arginfo.address    = vaddr;
-        arginfo.length     = vsize;
-        arginfo.crc32      = vcrc32;
+static uint8_t bl_seq_inflight(void)
+{
+    return (uint8_t)(inflight_head - inflight_tail);
+}
 
-        flash_erase(ARGINFO_ADDRESS, sizeof(arginfo));
-        flash_write(ARGINFO_ADDRESS, (const uint8_t *)&arginfo, sizeof(arginfo));
-    }
-    else
-        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_VERIFY);
+/* 帧头合法但 CRC 错误: 不等超时, 立即 NAK 让主机重传 */
+static void bl_parser_crc_error_cb(uint8_t opcode, uint16_t length)
+{
+    const bl_op_entry_t *op = bl_op_find(opcode);
+
+    if (op != NULL && (op->flags & BL_OP_FLAG_SEQ))
+        bl_seq_reject(opcode, BL_ERR_SEQ);
+}
+
+/* 当前 MTU 下接收环能容纳的窗口 */
+static uint8_t bl_window_limit(uint16_t frame_payload)
+{
+    uint32_t limit = rb_capacity(rx_rb) / (frame_payload + BL_FRAME_OVERHEAD);
+
+    return limit > BL_WINDOW_MAX ? BL_WINDOW_MAX : (uint8_t)limit;
 }
 
-static void bl_packet_handle(void)
+static void bl_op_inquery_handle(const bl_frame_t *frame)
 {
-    bl_opcode_t opcode = packet_buf[1];
-    switch (opcode)
+    printf("bl_op_inquery_handle\r\n");
+
+    uint8_t opcode = frame->opcode;
+    uint8_t param = frame->payload[0];
+
+    switch (param)
     {
-        case BL_OPCODE_NONE:
-        {
-            printf("none opcode\r\n");
-            break;
-        }
-        case BL_OPCODE_INQUERY:
-        {
-            bl_op_inquery_handle();
-            break;
-        }
-        case BL_OPCODE_BOOT:
+        case BL_INQUERY_PARAM_VERSION:
         {
-            bl_op_boot_handle();
+            uint8_t version[2] = {BOOTLOADER_VERSION_MAJOR, BOOTLOADER_VERSION_MINOR};
+            bl_response(opcode, sizeof(version), version);
             break;
         }
-        case BL_OPCODE_RESET:
+        case BL_INQUERY_PARAM_MIU:
         {
-            bl_op_reset_handle();
+            uint8_t mtu[2] = {(uint8_t)(parser.max_payload & 0xFF), (uint8_t)(parser.max_payload >> 8)};
+            bl_response(opcode, sizeof(mtu), mtu);
             break;
         }
-        case BL_OPCODE_ERASE:
+        case BL_INQUERY_PARAM_CAPS:
         {
-            bl_op_erase_handle();
+            /* | opcodes(4) | mtu(2) | mtu_max(2) | window(1) | crc(1) | compress(1) |
+             * opcodes 第 n 位表示操作码 0x10 + n 可用 */
+            uint32_t opcodes = 0;
+            for (uint8_t i = 0; i < ARRAY_SIZE(bl_op_table); i++)
+            {
+                uint8_t bit = bl_op_table[i].opcode - BL_OPCODE_INQUERY;
+                if (bit < 32)
+                    opcodes |= 1UL << bit;
+            }
+
+            uint16_t mtu = parser.max_payload;
+            uint8_t caps[11];
+            caps[0]  = (uint8_t)(opcodes);
+            caps[1]  = (uint8_t)(opcodes >> 8);
+            caps[2]  = (uint8_t)(opcodes >> 16);
+            caps[3]  = (uint8_t)(opcodes >> 24);
+            caps[4]  = (uint8_t)(mtu & 0xFF);
+            caps[5]  = (uint8_t)(mtu >> 8);
+            caps[6]  = (uint8_t)(PACKET_PAYLOAD_MAX_LENGTH & 0xFF);
+            caps[7]  = (uint8_t)(PACKET_PAYLOAD_MAX_LENGTH >> 8);
+            caps[8]  = bl_window_limit(mtu);
+            caps[9]  = BL_CAP_CRC_CRC16 | BL_CAP_CRC_CRC32;
+            caps[10] = BL_CAP_COMPRESS_LZ | BL_CAP_COMPRESS_PATCH;
+            bl_response(opcode, sizeof(caps), caps);
             break;
         }
-        case BL_OPCODE_WRITE:
+        case BL_INQUERY_PARAM_POOL:
         {
-            bl_op_write_handle();
+            /* | slots(1) | used(1) | high_water(1) | slot_size(2) | */
+            uint8_t pool[5];
+            pool[0] = (uint8_t)frame_pool.slot_num;
+            pool[1] = (uint8_t)bl_pool_used(&frame_pool);
+            pool[2] = (uint8_t)bl_pool_high_water(&frame_pool);
+            pool[3] = (uint8_t)(frame_pool.slot_size & 0xFF);
+            pool[4] = (uint8_t)(frame_pool.slot_size >> 8);
+            bl_response(opcode, sizeof(pool), pool);
             break;
         }
-        case BL_OPCODE_VERIFY:
+        case BL_INQUERY_PARAM_BOOT:
         {
-            bl_op_verify_handle();
+            /* | listen_ms(2) | boot_us(4) | image(1) | */
+            const bl_arginfo_t *arginfo = bl_arginfo_image();
+            uint32_t boot_us = RTC_ReadBackupRegister(BL_BOOT_TIME_BKP);
+            uint8_t boot[7];
+            boot[0] = (uint8_t)(BL_BOOT_LISTEN_MS & 0xFF);
+            boot[1] = (uint8_t)(BL_BOOT_LISTEN_MS >> 8);
+            boot[2] = (uint8_t)(boot_us);
+            boot[3] = (uint8_t)(boot_us >> 8);
+            boot[4] = (uint8_t)(boot_us >> 16);
+            boot[5] = (uint8_t)(boot_us >> 24);
+            boot[6] = arginfo == NULL ? 0 : (arginfo->state == ARGINFO_STATE_VALIDATED ? 2 : 1);
+            bl_response(opcode, sizeof(boot), boot);
             break;
         }
         default:
         {
-            bl_response_ack(opcode,1, BL_ERR_OPCODE);
+            bl_response_ack(opcode, 1, BL_ERR_PARAM);
             break;
         }
     }
 }
 
-void bootloader_main(void)
+/* 打开/关闭备份域写访问, 关闭时恢复 PWR 时钟的复位状态 */
+static void bl_boot_bkp_access(bool enable)
 {
-    printf("start bootloader\r\n");
+    if (enable)
+    {
+        RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, ENABLE);
+        PWR_BackupAccessCmd(ENABLE);
+    }
+    else
+    {
+        PWR_BackupAccessCmd(DISABLE);
+        RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, DISABLE);
+    }
+}
 
-    bl_uart_recv_callback_register(bl_uart_recv_cb);
+/* 自动跳转时把复位以来的耗时写入 BL_BOOT_TIME_BKP, 计时到 flush 和 deinit 之后, 紧挨着跳转 */
+static void bl_boot_app(bool auto_boot)
+{
+    extern void jump_to_app(uint32_t app_add);
 
-    rx_rb = rb_init(rx_rb_buf, sizeof(rx_rb_buf));
-    if (!rx_rb)
-        return ;
+    /* deinit usart, systick */
+    extern void board_deinit(void);
+    extern void cpu_tick_deinit(void);
 
-    bool boot_trap = false;
-    uint64_t last_byte_ticks = 0;
-    uint64_t now_ticks = 0;
+    bl_uart_flush();
 
-    while (1)
+    flash_job_deinit();
+    cpu_tick_deinit();
+    bl_uart_deinit();
+    board_deinit();
+
+    if (auto_boot)
     {
-        now_ticks = cpu_get_ticks();  // 循环开头统一更新时间
+        bl_boot_bkp_access(true);
+        uint32_t boot_us = (cpu_get_cycles() - boot_start_cycles) / TICKS_PER_US;
+        RTC_WriteBackupRegister(BL_BOOT_TIME_BKP, boot_us);
+        bl_boot_bkp_access(false);
+    }
 
-        if (boot_trap && (now_ticks - last_byte_ticks > TICKS_PER_MS * PACKET_RECV_BYTE_TIMEOUT))
-        {
-            boot_trap = false;
-            bl_packet_reset();
-            printf("recv timeout\r\n");
-            continue;
-        }
+    jump_to_app(APP_ADDRESS);
+}
+
+static void bl_op_boot_handle(const bl_frame_t *frame)
+{
+    bl_response_ack(BL_OPCODE_BOOT, 1, BL_ERR_OK);
+    bl_boot_app(false);
+}
+
+static void bl_op_setup_handle(const bl_frame_t *frame)
+{
+    const uint8_t *pbuf = frame->payload;
+    uint16_t length = frame->length;
+    uint8_t param = get_u8_le_inc(&pbuf);
 
-        if (rb_is_empty(rx_rb))
+    switch (param)
+    {
+        case BL_SETUP_PARAM_BAUD:
         {
-            if (!boot_trap)
-                last_byte_ticks = now_ticks; // 等待首字节，更新基准
-            continue;
+            if (length != 5)
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_FORMAT);
+                return ;
+            }
+
+            uint32_t baudrate = get_u32_le_inc(&pbuf);
+            uint32_t cur = bl_uart_get_baudrate();
+
+            /* 上一次协商尚未确认时, 以最初的波特率作为回退点 */
+            if (!baud_pending)
+                baud_prev = cur;
+
+            if (baudrate == cur)
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_OK);
+                return ;
+            }
+
+            if (!bl_uart_check_baudrate(baudrate))
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_PARAM);
+                return ;
+            }
+
+            /* ACK 以旧波特率发出, bl_uart_set_baudrate 会先等发送完成 */
+            bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_OK);
+            bl_uart_set_baudrate(baudrate);
+
+            printf("baudrate %lu -> %lu, wait confirm\r\n", baud_prev, baudrate);
+            baud_pending = true;
+            baud_switch_ticks = cpu_get_ticks();
+            break;
         }
+        case BL_SETUP_PARAM_BAUD_CONFIRM:
+        {
+            if (!baud_pending)
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_PARAM);
+                return ;
+            }
 
-        uint8_t byte;
-        if (rb_read(rx_rb, &byte))
+            baud_pending = false;
+            bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_OK);
+            break;
+        }
+        case BL_SETUP_PARAM_WINDOW:
         {
-            boot_trap = true;
-            printf("recv byte: 0x%02X\r\n", byte);
+            if (length != 4)
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_FORMAT);
+                return ;
+            }
+
+            uint8_t window = get_u8_le_inc(&pbuf);
+            uint16_t frame_payload = get_u16_le_inc(&pbuf);
 
-            if (bl_recv_handle(byte))
+            if (window == 0 || frame_payload == 0 || frame_payload > parser.max_payload)
             {
-                printf("recv full packet\r\n");
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_PARAM);
+                return ;
+            }
+
+            /* 窗口内的帧都要能同时留在接收环里, 否则 DMA 接收会丢字节 */
+            uint8_t limit = bl_window_limit(frame_payload);
+            if (window > limit)
+                window = limit;
+
+            win_size = window;
+            bl_seq_reset();
+
+            uint8_t rsp[2] = {BL_ERR_OK, win_size};
+            bl_response(BL_OPCODE_SETUP, sizeof(rsp), rsp);
+            printf("window: %u, frame payload: %u\r\n", win_size, frame_payload);
+            break;
+        }
+        case BL_SETUP_PARAM_MTU:
+        {
+            if (length != 3)
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_FORMAT);
+                return ;
+            }
 
-                bl_packet_handle();
-                bl_packet_reset();
+            uint16_t mtu = get_u16_le_inc(&pbuf);
+            if (mtu < PACKET_PAYLOAD_MIN_LENGTH)
+            {
+                bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_PARAM);
+                return ;
             }
 
-            last_byte_ticks = now_ticks; // 每次收到字节刷新超时基准
+            if (mtu > PACKET_PAYLOAD_MAX_LENGTH)
+                mtu = PACKET_PAYLOAD_MAX_LENGTH;
+            mtu = bl_parser_set_max_payload(&parser, mtu);
+
+            uint8_t rsp[3] = {BL_ERR_OK, (uint8_t)(mtu & 0xFF), (uint8_t)(mtu >> 8)};
+            bl_response(BL_OPCODE_SETUP, sizeof(rsp), rsp);
+            printf("mtu: %u\r\n", mtu);
+            break;
+        }
+        default:
+        {
+            bl_response_ack(BL_OPCODE_SETUP, 1, BL_ERR_PARAM);
+            break;
+        }
+    }
+}
+
+static void bl_baud_poll(uint64_t now_ticks)
+{
+    if (!baud_pending)
+        return ;
+
+    if (now_ticks - baud_switch_ticks > TICKS_PER_MS * BL_BAUD_CONFIRM_TIMEOUT)
+    {
+        baud_pending = false;
+        bl_uart_set_baudrate(baud_prev);
+        bl_parser_flush(&parser);
+        printf("baudrate not confirmed, revert to %lu\r\n", baud_prev);
+    }
+}
+
+#if BL_UART_AUTOBAUD
+/*
+ * 自动波特率状态: 检测在 EXTI 中断里完成, 这里只取结果并在需要时重新开始检测。
+ * 波特率协商未确认时不重新检测; 收到一半的帧交给接收超时和 CRC 丢弃。
+ */
+static void bl_autobaud_poll(uint64_t now_ticks, uint64_t last_byte_ticks)
+{
+    static uint32_t last_errors = 0;
+
+    uint32_t baudrate = bl_uart_autobaud_poll();
+    if (baudrate)
+        printf("autobaud: %lu\r\n", baudrate);
+
+    uint32_t errors = bl_uart_rx_errors();
+    bool noisy = errors != last_errors;
+    last_errors = errors;
+
+    if (bl_uart_autobaud_active() || baud_pending)
+        return ;
+
+    /* 帧错误/噪声说明波特率已不对; 空闲时主机可能已换了波特率 */
+    if (noisy || (!bl_parser_pending(&parser) &&
+                  now_ticks - last_byte_ticks > TICKS_PER_MS * BL_AUTOBAUD_IDLE_MS))
+        bl_uart_autobaud_start();
+}
+#endif
+
+static void bl_op_reset_handle(const bl_frame_t *frame)
+{
+    bl_response_ack(BL_OPCODE_RESET, 1, BL_ERR_OK);
+    bl_uart_flush();
+    __disable_irq();
+    NVIC_SystemReset();
+}
+
+/* | errcode | erased(2) | skipped(2) |, 按扇区号置位 */
+static void bl_erase_response(uint8_t opcode, uint8_t errcode, const flash_erase_report_t *report)
+{
+    uint8_t rsp[5];
+
+    rsp[0] = errcode;
+    rsp[1] = (uint8_t)(report->erased & 0xFF);
+    rsp[2] = (uint8_t)(report->erased >> 8);
+    rsp[3] = (uint8_t)(report->skipped & 0xFF);
+    rsp[4] = (uint8_t)(report->skipped >> 8);
+    bl_response(opcode, sizeof(rsp), rsp);
+}
+
+static void bl_erase_job_done(void);
+static void bl_erase_job_cb(flash_job_status_t status, void *arg);
+
+/* 队列有空位就继续提交, 出错后不再提交 */
+static void bl_erase_job_submit(void)
+{
+    while (!erase_job.fail && erase_job.next <= erase_job.last && flash_job_space() > 0)
+    {
+        if (!flash_job_erase(erase_job.next, bl_erase_job_cb, (void *)(intptr_t)erase_job.next))
+        {
+            erase_job.fail = true;
+            break;
+        }
+        erase_job.next++;
+        erase_job.pending++;
+    }
+}
+
+static void bl_erase_job_cb(flash_job_status_t status, void *arg)
+{
+    int sector = (int)(intptr_t)arg;
+
+    erase_job.pending--;
+    if (status == FLASH_JOB_FAIL)
+        erase_job.fail = true;
+    else if (status == FLASH_JOB_DONE)
+        erase_job.report.erased |= 1u << sector;
+    else
+        erase_job.report.skipped |= 1u << sector;
+
+    bl_erase_job_submit();
+    if (erase_job.pending == 0 && (erase_job.fail || erase_job.next > erase_job.last))
+    {
+        erase_job.active = false;
+        bl_erase_job_done();
+    }
+}
+
+/*
+ * 开始擦除与 [addr, addr + size) 重叠的扇区, 完成后由 bl_erase_job_done 按 opcode 应答。
+ * 调用者须先确认上一次擦除已结束且队列有空位, 否则置 frame_retry 稍后重试。
+ */
+static void bl_erase_job_start(uint8_t opcode, uint32_t addr, uint32_t size)
+{
+    erase_job.active  = true;
+    erase_job.fail    = false;
+    erase_job.opcode  = opcode;
+    erase_job.next    = (int8_t)flash_sector_index(addr);
+    erase_job.last    = (int8_t)flash_sector_index(addr + size - 1);
+    erase_job.pending = 0;
+    erase_job.report.erased  = 0;
+    erase_job.report.skipped = 0;
+
+    bl_erase_job_submit();
+    if (erase_job.pending == 0)
+    {
+        /* 第一个扇区都没能提交, 就地应答失败 */
+        erase_job.active = false;
+        bl_erase_job_done();
+    }
+}
+
+static void bl_op_erase_handle(const bl_frame_t *frame)
+{
+    /* param: addr size -- 8 bytes */
+    const uint8_t *pbuf = frame->payload;
+
+    uint32_t addr = get_u32_le_inc(&pbuf);
+    uint32_t size = get_u32_le_inc(&pbuf);
+
+    if (!bl_app_region_valid(addr, size))
+    {
+        bl_response_ack(BL_OPCODE_ERASE, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    if (erase_job.active || !bl_arginfo_touch() || flash_job_space() == 0)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    bl_erase_job_start(BL_OPCODE_ERASE, addr, size);
+}
+
+/* 0x22 的编程任务完成 (主循环): 归还池块后应答 */
+static void bl_write_done_cb(flash_job_status_t status, void *arg)
+{
+    bl_pool_free(&frame_pool, arg);
+    bl_response_ack(BL_OPCODE_WRITE, 1, status == FLASH_JOB_FAIL ? BL_ERR_UNKNOWN : BL_ERR_OK);
+}
+
+static void bl_op_write_handle(const bl_frame_t *frame)
+{
+    const uint8_t *pbuf = frame->payload;
+    uint16_t length = frame->length;
+
+    uint32_t addr = get_u32_le_inc(&pbuf);
+    uint32_t size = get_u32_le_inc(&pbuf);
+
+    if (size > length - 8u)
+    {
+        bl_response_ack(BL_OPCODE_WRITE, 1, BL_ERR_FORMAT);
+        return ;
+    }
+
+    if (!bl_app_region_valid(addr, size))
+    {
+        bl_response_ack(BL_OPCODE_WRITE, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    if (!bl_arginfo_touch() || flash_job_space() == 0)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    /* 帧转到池块, 编程完成后由 bl_write_done_cb 应答, 期间照常收发 */
+    bl_frame_t held;
+    uint8_t *slot = bl_parser_detach(&parser, &held);
+    if (slot == NULL)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    if (!flash_job_program(addr, held.payload + (pbuf - frame->payload), size, bl_write_done_cb, slot))
+    {
+        bl_pool_free(&frame_pool, slot);
+        bl_response_ack(BL_OPCODE_WRITE, 1, BL_ERR_UNKNOWN);
+    }
+}
+
+/* 流水帧的编程任务完成 (主循环): 归还池块, 按提交顺序推进确认 */
+static void bl_seq_write_done_cb(flash_job_status_t status, void *arg)
+{
+    bl_inflight_t *f = (bl_inflight_t *)arg;
+    bool ok = status != FLASH_JOB_FAIL;
+
+    bl_pool_free(&frame_pool, f->slot);
+    inflight_tail++;
+
+    if (f->epoch != win_epoch)
+        return ;
+
+    if (f->opcode == BL_OPCODE_DATA)
+    {
+        ok = ok && !session.erase_error;
+        session.erase_error = false;
+    }
+
+    if (ok)
+    {
+        win_acked = f->seq + 1;
+        bl_seq_response(f->opcode, BL_ERR_OK);
+        return ;
+    }
+
+    /* 从失败的帧重新接收, 其后已提交的帧作废 */
+    bl_seq_rewind(f->seq);
+    if (f->opcode == BL_OPCODE_DATA)
+        session.offset = f->offset;
+    bl_seq_reject(f->opcode, BL_ERR_UNKNOWN);
+}
+
+/*
+ * 把当前帧转到池块中, 编程 [addr, addr + size) 的任务提交到 flash 队列后序号立即推进,
+ * 接收环随即释放, 解析器接着处理后续帧; 确认由 bl_seq_write_done_cb 在编程完成后发出。
+ * 池用尽时置 frame_retry, 帧留在接收环中。data 须指向 frame 的 payload 内。返回是否已提交。
+ */
+static bool bl_seq_submit(const bl_frame_t *frame, const uint8_t *data, uint32_t addr, uint32_t size)
+{
+    bl_frame_t held;
+    uint8_t *slot = bl_parser_detach(&parser, &held);
+
+    if (slot == NULL)
+    {
+        frame_retry = true;
+        return false;
+    }
+
+    bl_inflight_t *f = &inflight[inflight_head % BL_FRAME_POOL_SLOTS];
+    if (!flash_job_program(addr, held.payload + (data - frame->payload), size, bl_seq_write_done_cb, f))
+    {
+        bl_pool_free(&frame_pool, slot);
+        bl_seq_reject(frame->opcode, BL_ERR_UNKNOWN);
+        return false;
+    }
+
+    f->slot   = slot;
+    f->opcode = frame->opcode;
+    f->seq    = win_expected;
+    f->epoch  = win_epoch;
+    f->offset = session.offset;
+    inflight_head++;
+
+    win_expected++;
+    win_nak_sent = false;
+    return true;
+}
+
+static void bl_op_write_seq_handle(const bl_frame_t *frame)
+{
+    /* param: seq addr size data -- 10 + n bytes */
+    const uint8_t *pbuf = frame->payload;
+    uint16_t length = frame->length;
+
+    uint16_t seq  = get_u16_le_inc(&pbuf);
+    uint32_t addr = get_u32_le_inc(&pbuf);
+    uint32_t size = get_u32_le_inc(&pbuf);
+
+    switch (bl_seq_check(seq))
+    {
+        case BL_SEQ_DUP:
+        {
+            /* 之前的确认丢了, 重发累积确认即可 */
+            bl_seq_response(BL_OPCODE_WRITE_SEQ, BL_ERR_OK);
+            return ;
+        }
+        case BL_SEQ_GAP:
+        {
+            bl_seq_reject(BL_OPCODE_WRITE_SEQ, BL_ERR_SEQ);
+            return ;
+        }
+        default:
+            break;
+    }
+
+    if (size == 0 || size > length - 10u)
+    {
+        bl_seq_reject(BL_OPCODE_WRITE_SEQ, BL_ERR_FORMAT);
+        return ;
+    }
+
+    if (!bl_app_region_valid(addr, size))
+    {
+        bl_seq_reject(BL_OPCODE_WRITE_SEQ, BL_ERR_PARAM);
+        return ;
+    }
+
+    if (!bl_arginfo_touch() || flash_job_space() == 0)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    bl_seq_submit(frame, pbuf, addr, size);
+}
+
+static void bl_op_read_handle(const bl_frame_t *frame)
+{
+    /* param: addr size -- 8 bytes */
+    const uint8_t *pbuf = frame->payload;
+
+    uint32_t addr = get_u32_le_inc(&pbuf);
+    uint32_t size = get_u32_le_inc(&pbuf);
+
+    if (!bl_flash_region_valid(addr, size))
+    {
+        bl_response_ack(BL_OPCODE_READ, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    if ((uint8_t)(read_head - read_tail) == BL_READ_QUEUE_DEPTH)
+    {
+        bl_response_ack(BL_OPCODE_READ, 1, BL_ERR_OVERFLOW);
+        return ;
+    }
+
+    /* 由 bl_read_poll 在主循环中逐帧发出 */
+    bl_read_req_t *req = &read_queue[read_head % BL_READ_QUEUE_DEPTH];
+    req->addr = addr;
+    req->size = size;
+    read_head++;
+}
+
+/* DMA 中断上下文: 一帧的数据段发送完成 */
+static void bl_read_done_cb(void *arg)
+{
+    read_frames_done++;
+}
+
+/*
+ * 帧头和 CRC 拷贝进发送 FIFO, 数据段直接从 Flash 经 DMA 发出。
+ * 数据段提交失败时 bl_read_done_cb 不会被调用, 退回同步发送补完这一帧并返回 false
+ */
+static bool bl_read_send_frame(uint32_t addr, uint16_t size)
+{
+    uint16_t length = BL_READ_HEAD_LEN + size;
+    uint8_t head[BL_FRAME_HEAD_LEN + BL_READ_HEAD_LEN];
+    uint8_t tail[BL_FRAME_CRC_LEN];
+    crc16_ctx_t ctx;
+
+    head[0] = BL_FRAME_HEADER;
+    head[1] = BL_OPCODE_READ;
+    head[2] = (uint8_t)(length & 0xFF);
+    head[3] = (uint8_t)(length >> 8);
+    head[4] = BL_ERR_OK;
+    head[5] = (uint8_t)(addr);
+    head[6] = (uint8_t)(addr >> 8);
+    head[7] = (uint8_t)(addr >> 16);
+    head[8] = (uint8_t)(addr >> 24);
+
+    crc16_init(&ctx);
+    crc16_update(&ctx, &head[1], sizeof(head) - 1);
+    crc16_update(&ctx, (const uint8_t *)addr, size);
+    uint16_t crc = crc16_final(&ctx);
+
+    tail[0] = (uint8_t)(crc & 0xFF);
+    tail[1] = (uint8_t)(crc >> 8);
+
+    bool ok = true;
+    bl_uart_send(head, sizeof(head));
+    if (bl_uart_send_async((const uint8_t *)addr, size, bl_read_done_cb, NULL))
+        read_frames_queued++;
+    else
+    {
+        bl_uart_send((uint8_t *)addr, size);
+        ok = false;
+    }
+    bl_uart_send(tail, sizeof(tail));
+    return ok;
+}
+
+/* 保持 BL_READ_INFLIGHT 帧在发送队列中: 一帧在发, 下一帧的 CRC 已算好排队 */
+static void bl_read_poll(void)
+{
+    while (read_head != read_tail &&
+           read_frames_queued - read_frames_done < BL_READ_INFLIGHT)
+    {
+        bl_read_req_t *req = &read_queue[read_tail % BL_READ_QUEUE_DEPTH];
+        uint32_t size = parser.max_payload - BL_READ_HEAD_LEN;
+
+        if (size > req->size)
+            size = req->size;
+
+        if (!bl_read_send_frame(req->addr, (uint16_t)size))
+        {
+            /* 发送队列不可用, 丢弃排队的回读并以错误结束 */
+            read_tail = read_head;
+            bl_response_ack(BL_OPCODE_READ, 1, BL_ERR_UNKNOWN);
+            return ;
+        }
+        req->addr += size;
+        req->size -= size;
+
+        if (req->size == 0)
+            read_tail++;
+    }
+}
+
+/* arginfo 落盘 (主循环): 主机收到确认时记录已在 flash 中 */
+static void bl_verify_saved_cb(bool ok)
+{
+    bl_verify_t *v = &verify_job;
+
+    v->saving = false;
+    if (!ok)
+    {
+        bl_response_ack(v->opcode, 1, BL_ERR_UNKNOWN);
+        return ;
+    }
+
+    if (v->opcode == BL_OPCODE_END && (session.inplace || session.auto_erase))
+    {
+        flash_erase_report_t report;
+        report.erased  = session.sector_erased;
+        report.skipped = session.sector_seen & ~session.sector_erased;
+        bl_erase_response(v->opcode, BL_ERR_OK, &report);
+    }
+    else
+        bl_response_ack(v->opcode, 1, BL_ERR_OK);
+    printf("verify ok: 0x%08lX, %lu bytes\r\n", v->addr, v->size);
+}
+
+/* 主循环: 校验通过的镜像在上一次 arginfo 更新完成、队列有空位后提交记录 */
+static void bl_verify_poll(void)
+{
+    bl_verify_t *v = &verify_job;
+
+    if (!v->save_pending || !bl_arginfo_ready())
+        return ;
+
+    v->save_pending = false;
+    v->saving = bl_arginfo_save(v->addr, v->size, v->crc32, bl_verify_saved_cb);
+    if (!v->saving)
+        bl_response_ack(v->opcode, 1, BL_ERR_UNKNOWN);
+}
+
+/* 校验完成 (主循环上下文): 通过则由 bl_verify_poll 写入 arginfo, 落盘后再确认 */
+static void bl_verify_done_cb(uint32_t crc, void *arg)
+{
+    bl_verify_t *v = (bl_verify_t *)arg;
+
+    if (crc != v->crc32)
+    {
+        bl_response_ack(v->opcode, 1, BL_ERR_VERIFY);
+        return ;
+    }
+
+    v->save_pending = true;
+    bl_verify_poll();
+}
+
+/* CRC 由 crc_hw_poll 在主循环中分块计算, 期间仍可收发 */
+static bool bl_verify_start(uint8_t opcode, uint32_t addr, uint32_t size, uint32_t crc)
+{
+    if (crc_hw_busy() || verify_job.save_pending || verify_job.saving)
+        return false;
+
+    verify_job.opcode = opcode;
+    verify_job.addr   = addr;
+    verify_job.size   = size;
+    verify_job.crc32  = crc;
+    return crc_hw_start((const uint8_t *)addr, size, bl_verify_done_cb, &verify_job);
+}
+
+static void bl_op_verify_handle(const bl_frame_t *frame)
+{
+    /* param: add size crc --- 12 bytes */
+    const uint8_t *pbuf = frame->payload;
+
+    uint32_t vaddr  = get_u32_le_inc(&pbuf);
+    uint32_t vsize  = get_u32_le_inc(&pbuf);
+    uint32_t vcrc32 = get_u32_le_inc(&pbuf);
+
+    if (!bl_app_region_valid(vaddr, vsize))
+    {
+        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    if (!bl_verify_start(BL_OPCODE_VERIFY, vaddr, vsize, vcrc32))
+        bl_response_ack(BL_OPCODE_VERIFY, 1, BL_ERR_OVERFLOW);
+}
+
+/* 自动擦除的扇区任务完成 (主循环): 擦除过或本来为空都标记为可写 */
+static void bl_session_erase_cb(flash_job_status_t status, void *arg)
+{
+    int sector = (int)(intptr_t)arg;
+
+    session.sector_pending &= ~(1u << sector);
+    if (status == FLASH_JOB_FAIL)
+    {
+        session.erase_error = true;
+        return ;
+    }
+
+    session.sector_seen |= 1u << sector;
+    if (status == FLASH_JOB_DONE)
+        session.sector_erased |= 1u << sector;
+}
+
+/* 扇区未就绪且未排队时提交擦除任务 (空扇区由任务跳过) */
+static bool bl_session_erase_queue(int sector)
+{
+    if ((session.sector_seen | session.sector_pending) & (1u << sector))
+        return true;
+
+    if (!flash_job_erase(sector, bl_session_erase_cb, (void *)(intptr_t)sector))
+        return false;
+
+    session.sector_pending |= 1u << sector;
+    return true;
+}
+
+/*
+ * 预擦下一个扇区, 与后续数据的接收重叠。要排在当前帧的编程任务之后提交,
+ * 否则当前帧要等它擦完; 只在队列还有富余时提交, 不挤占下一帧需要的位置。
+ */
+static void bl_session_erase_ahead(int sector)
+{
+    uint32_t start, size;
+
+    if (!session.auto_erase || !flash_sector_info(sector, &start, &size))
+        return ;
+
+    /* 只擦与会话区域重叠的扇区 */
+    if (start >= session.out_addr + session.size || start + size <= session.out_addr)
+        return ;
+
+    if (flash_job_space() > BL_DATA_JOBS_MAX)
+        bl_session_erase_queue(sector);
+}
+
+/* 自动擦除模式写 [addr, addr + length) 之前调用, 为未就绪的扇区排队擦除, 之后提交的编程任务排在其后 */
+static bool bl_session_prepare(uint32_t addr, uint32_t length)
+{
+    if (!session.auto_erase)
+        return true;
+
+    int first = flash_sector_index(addr);
+    int last  = flash_sector_index(addr + length - 1);
+
+    for (int i = first; i <= last; i++)
+    {
+        if (!bl_session_erase_queue(i))
+            return false;
+    }
+    return true;
+}
+
+/* 输出池块编程完成 (主循环) */
+static void bl_session_out_done_cb(flash_job_status_t status, void *arg)
+{
+    bl_pool_free(&frame_pool, arg);
+    session.out_busy--;
+    if (status == FLASH_JOB_FAIL)
+        session.out_error = true;
+}
+
+/*
+ * 把攒好的输出交给 flash 任务队列: 先为涉及的扇区排队擦除 (自动擦除模式), 再提交编程,
+ * 之后预擦下一个扇区。队列空位不足时等待前面的任务完成。
+ */
+static bool bl_session_out_submit(void)
+{
+    uint8_t *slot = session.out_slot;
+    uint32_t length = session.out_fill;
+    uint32_t addr = session.out_addr + session.offset - length;
+
+    if (slot == NULL || length == 0)
+        return true;
+
+    while (flash_job_space() < BL_DATA_JOBS_MAX)
+        flash_job_poll();
+
+    if (!bl_session_prepare(addr, length) ||
+        !flash_job_program(addr, slot, length, bl_session_out_done_cb, slot))
+        return false;
+
+    session.out_slot = NULL;
+    session.out_fill = 0;
+    session.out_busy++;
+    bl_session_erase_ahead(flash_sector_index(addr + length - 1) + 1);
+    return true;
+}
+
+/* 可以不等待地接收一段输出: 当前池块还有位置, 或者能再取一块且队列有空位 */
+static bool bl_session_out_ready(void)
+{
+    if (session.out_slot != NULL && session.out_fill + BL_LZ_FLUSH_SIZE <= BL_SESSION_OUT_SIZE)
+        return true;
+
+    return session.out_busy < BL_SESSION_OUT_SLOTS - 1 && flash_job_space() >= BL_DATA_JOBS_MAX &&
+           bl_pool_used(&frame_pool) < frame_pool.slot_num;
+}
+
+/* 丢弃还没提交的输出 */
+static void bl_session_out_release(void)
+{
+    bl_pool_free(&frame_pool, session.out_slot);
+    session.out_slot = NULL;
+    session.out_fill = 0;
+}
+
+/*
+ * 压缩/差分模式的最终输出。解码器按 BL_LZ_FLUSH_SIZE, 补丁按 BL_PATCH_BUF_SIZE 分段输出,
+ * 只有最后一段可能不足, 因此写地址始终字对齐。输出拷进池块后立即返回, 解码器可以接着覆盖窗口;
+ * 只有一帧解出的数据超过一块、前一块还在编程时才在这里等待。
+ */
+static bool bl_session_output(const uint8_t *data, uint32_t length, void *arg)
+{
+    (void)arg;
+
+    if (session.erase_error || session.out_error)
+        return false;
+
+    if (session.out_slot != NULL && session.out_fill + length > BL_SESSION_OUT_SIZE)
+    {
+        if (!bl_session_out_submit())
+            return false;
+    }
+
+    while (session.out_slot == NULL)
+    {
+        if (session.out_busy < BL_SESSION_OUT_SLOTS - 1)
+            session.out_slot = bl_pool_alloc(&frame_pool);
+        if (session.out_slot == NULL)
+            flash_job_poll();
+    }
+
+    memcpy(session.out_slot + session.out_fill, data, length);
+    session.out_fill += length;
+    crc32_update(&session.out_crc, data, length);
+    session.offset += length;
+    return true;
+}
+
+/* 提交剩余输出并等待全部编程完成, 返回擦写是否都成功 */
+static bool bl_session_out_flush(void)
+{
+    bool ok = bl_session_out_submit();
+
+    flash_job_flush();
+    bl_session_out_release();
+    ok = ok && !session.erase_error && !session.out_error;
+    session.erase_error = false;
+    session.out_error = false;
+    return ok;
+}
+
+/* 压缩的补丁: 解压输出再交给补丁 */
+static bool bl_session_lz_to_patch(const uint8_t *data, uint32_t length, void *arg)
+{
+    (void)arg;
+    return bl_patch_feed(&session_patch, data, length);
+}
+
+static bool bl_session_feed(const uint8_t *data, uint32_t length)
+{
+    if (session.compress)
+        return bl_lz_feed(&session_lz, data, length);
+    return bl_patch_feed(&session_patch, data, length);
+}
+
+static bool bl_session_finish(void)
+{
+    if (session.compress && !bl_lz_finish(&session_lz))
+        return false;
+    if (session.patch && !bl_patch_finish(&session_patch))
+        return false;
+    return true;
+}
+
+/*
+ * 差分模式 BEGIN 的附加检查, 返回 errcode。源镜像以 arginfo 为准;
+ * staging 按扇区对齐且位于源镜像和目标区域之后, 擦除 staging 时不会碰到两者。
+ */
+static uint8_t bl_session_patch_check(uint32_t addr, uint32_t size, uint32_t src_crc, uint32_t staging)
+{
+    const bl_arginfo_t *arginfo = bl_arginfo_image();
+    uint32_t start, sector_size;
+
+    if (arginfo == NULL)
+        return BL_ERR_PARAM;
+
+    if (arginfo->crc32 != src_crc)
+        return BL_ERR_VERIFY;
+
+    if (!flash_sector_info(flash_sector_index(staging), &start, &sector_size) || start != staging)
+        return BL_ERR_PARAM;
+
+    if (!bl_app_region_valid(staging, size) ||
+        staging < arginfo->address + arginfo->length || staging < addr + size)
+        return BL_ERR_PARAM;
+
+    return BL_ERR_OK;
+}
+
+/* 差分模式 END 的拷贝完成 (主循环): 回读校验并写入 arginfo 后应答 */
+static void bl_session_install_cb(flash_job_status_t status, void *arg)
+{
+    (void)arg;
+
+    if (status == FLASH_JOB_FAIL)
+    {
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_UNKNOWN);
+        return ;
+    }
+
+    if (!bl_verify_start(BL_OPCODE_END, session.addr, session.size, session.crc32))
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_OVERFLOW);
+}
+
+/*
+ * 差分模式 END: 新镜像已在 staging 校验通过, 作废 arginfo 后拷贝到目标区域, 中途掉电则停在 bootloader。
+ * 擦除走区域擦除任务, 擦完后 (bl_erase_job_done) 调用这里把 staging 整段交给编程任务。
+ */
+static void bl_session_install(void)
+{
+    if (!flash_job_program(session.addr, (const uint8_t *)session.out_addr, session.size,
+                           bl_session_install_cb, NULL))
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_UNKNOWN);
+}
+
+static void bl_op_begin_handle(const bl_frame_t *frame)
+{
+    /* param: addr size crc flags -- 13 bytes */
+    const uint8_t *pbuf = frame->payload;
+
+    uint32_t addr  = get_u32_le_inc(&pbuf);
+    uint32_t size  = get_u32_le_inc(&pbuf);
+    uint32_t crc   = get_u32_le_inc(&pbuf);
+    uint8_t  flags = get_u8_le_inc(&pbuf);
+
+    if (frame->length != ((flags & BL_SESSION_FLAG_PATCH) ? BL_BEGIN_PATCH_LEN : BL_BEGIN_LEN))
+    {
+        bl_response_ack(BL_OPCODE_BEGIN, 1, BL_ERR_FORMAT);
+        return ;
+    }
+
+    /* 边界只在这里检查一次, DATA 帧只需检查是否超出 size */
+    if (!bl_app_region_valid(addr, size) || (addr & 0x3))
+    {
+        bl_response_ack(BL_OPCODE_BEGIN, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    /* 解压/补丁输出只能顺序写入, 依赖预先擦除或自动擦除 */
+    if ((flags & (BL_SESSION_FLAG_COMPRESS | BL_SESSION_FLAG_PATCH)) &&
+        !(flags & (BL_SESSION_FLAG_ERASE | BL_SESSION_FLAG_AUTO_ERASE)))
+    {
+        bl_response_ack(BL_OPCODE_BEGIN, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    if ((flags & BL_SESSION_FLAG_AUTO_ERASE) && (flags & (BL_SESSION_FLAG_ERASE | BL_SESSION_FLAG_INPLACE)))
+    {
+        bl_response_ack(BL_OPCODE_BEGIN, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    uint32_t out_addr = addr;
+    if (flags & BL_SESSION_FLAG_PATCH)
+    {
+        uint32_t src_crc = get_u32_le_inc(&pbuf);
+        out_addr = get_u32_le_inc(&pbuf);
+
+        uint8_t err = bl_session_patch_check(addr, size, src_crc, out_addr);
+        if (err != BL_ERR_OK)
+        {
+            bl_response_ack(BL_OPCODE_BEGIN, 1, err);
+            return ;
+        }
+    }
+
+    if (erase_job.active)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    session.active = false;
+    flash_job_flush();     // 上一个会话的任务回调不能落到新会话上
+    bl_session_out_release();
+    bl_arginfo_touch();     // 队列已清空, 不会被推迟
+
+    session.addr    = addr;
+    session.size    = size;
+    session.crc32   = crc;
+    session.offset  = 0;
+    session.inplace = (flags & (BL_SESSION_FLAG_ERASE | BL_SESSION_FLAG_INPLACE)) == BL_SESSION_FLAG_INPLACE;
+    session.sector_seen   = 0;
+    session.sector_erased = 0;
+    session.auto_erase    = (flags & BL_SESSION_FLAG_AUTO_ERASE) != 0;
+    session.erase_error   = false;
+    session.sector_pending = 0;
+    session.compress = (flags & BL_SESSION_FLAG_COMPRESS) != 0;
+    session.patch    = (flags & BL_SESSION_FLAG_PATCH) != 0;
+    session.out_addr = out_addr;
+    session.out_error = false;
+    session.out_busy  = 0;
+    crc32_init(&session.out_crc);
+    if (session.patch)
+    {
+        const bl_arginfo_t *arginfo = bl_arginfo_image();
+        bl_patch_init(&session_patch, (const uint8_t *)arginfo->address, arginfo->length,
+                      session_patch_buf, sizeof(session_patch_buf), size, bl_session_output, NULL);
+    }
+    if (session.compress)
+    {
+        /* 解压出的补丁流长度未知, 由补丁按 size 限制输出 */
+        if (session.patch)
+            bl_lz_init(&session_lz, session_lz_window, UINT32_MAX, bl_session_lz_to_patch, NULL);
+        else
+            bl_lz_init(&session_lz, session_lz_window, size, bl_session_output, NULL);
+    }
+    bl_seq_reset();
+
+    /* 预先擦除的会话在擦完之后才生效并应答, 见 bl_erase_job_done */
+    if (flags & BL_SESSION_FLAG_ERASE)
+    {
+        bl_erase_job_start(BL_OPCODE_BEGIN, out_addr, size);
+        return ;
+    }
+
+    session.active = true;
+
+    /* 第一帧到达之前先开始擦第一个扇区 */
+    bl_session_erase_ahead(flash_sector_index(out_addr));
+
+    flash_erase_report_t report = {0, 0};
+    bl_erase_response(BL_OPCODE_BEGIN, BL_ERR_OK, &report);
+    printf("session begin: 0x%08lX, %lu bytes\r\n", addr, size);
+}
+
+/* 区域擦除全部回调后 (主循环) 应答; BEGIN 的擦除成功后会话才生效, 差分 END 的擦除成功后开始拷贝 */
+static void bl_erase_job_done(void)
+{
+    uint8_t err = erase_job.fail ? BL_ERR_UNKNOWN : BL_ERR_OK;
+
+    if (erase_job.opcode == BL_OPCODE_END)
+    {
+        if (erase_job.fail)
+            bl_response_ack(BL_OPCODE_END, 1, BL_ERR_UNKNOWN);
+        else
+            bl_session_install();
+        return ;
+    }
+
+    if (erase_job.opcode == BL_OPCODE_BEGIN)
+    {
+        session.active = !erase_job.fail;
+        if (session.active)
+            printf("session begin: 0x%08lX, %lu bytes\r\n", session.addr, session.size);
+    }
+
+    bl_erase_response(erase_job.opcode, err, &erase_job.report);
+}
+
+/* 原地模式冲突扇区擦完 (主循环): 期望序号在提交擦除时已经回退, 这里告诉主机 */
+static void bl_session_inplace_erase_cb(flash_job_status_t status, void *arg)
+{
+    int sector = (int)(intptr_t)arg;
+
+    session.sector_pending &= ~(1u << sector);
+    if (!session.active)
+        return ;
+    if (status != FLASH_JOB_FAIL)
+        session.sector_erased |= 1u << sector;
+
+    /* 期望序号已经变了, 主机必须收到这次回退; 不受 "每个序号只 NAK 一次" 的限制 */
+    win_nak_sent = true;
+    bl_seq_response(BL_OPCODE_DATA, status == FLASH_JOB_FAIL ? BL_ERR_UNKNOWN : BL_ERR_REWIND);
+}
+
+/*
+ * 原地模式写一帧。冲突所在扇区擦除后, 本会话之前写进该扇区的内容也没了,
+ * 因此把 offset 和期望序号退回该扇区第一帧, 由主机重发; 退回途中
+ * 再写到前一个扇区的数据与已有内容相同, 不会再次冲突。
+ * 扇区有一部分在会话区域之外时不擦除: 那部分主机不会重发, 擦掉就找不回来了。
+ * 擦除交给 flash 任务队列, 回退立即生效, REWIND 在擦完后由 bl_session_inplace_erase_cb 发出。
+ */
+static bl_err_t bl_session_write_inplace(uint16_t seq, const uint8_t *data, uint32_t size)
+{
+    uint32_t addr = session.addr + session.offset;
+    int first = flash_sector_index(addr);
+    int last  = flash_sector_index(addr + size - 1);
+    uint32_t conflict;
+
+    for (int i = first; i <= last; i++)
+    {
+        if (!(session.sector_seen & (1u << i)))
+        {
+            session.sector_seen |= 1u << i;
+            session.sector_seq[i] = seq;
+            session.sector_offset[i] = session.offset;
+        }
+    }
+
+    switch (flash_write_inplace(addr, data, size, &conflict))
+    {
+        case FLASH_INPLACE_OK:
+            return BL_ERR_OK;
+        case FLASH_INPLACE_NEED_ERASE:
+            break;
+        default:
+            return BL_ERR_UNKNOWN;
+    }
+
+    int sector = flash_sector_index(conflict);
+
+    /* 本会话擦过的扇区只会被顺序写入, 不应再冲突 */
+    if (session.sector_erased & (1u << sector))
+        return BL_ERR_UNKNOWN;
+
+    uint32_t start, sector_size;
+    flash_sector_info(sector, &start, &sector_size);
+    if (start < session.addr || start + sector_size > session.addr + session.size)
+    {
+        printf("sector %d not a bit subset and not covered by the session\r\n", sector);
+        return BL_ERR_NEED_ERASE;
+    }
+
+    if (!flash_job_erase(sector, bl_session_inplace_erase_cb, (void *)(intptr_t)sector))
+        return BL_ERR_UNKNOWN;
+
+    session.sector_pending |= 1u << sector;
+    session.offset = session.sector_offset[sector];
+    bl_seq_rewind(session.sector_seq[sector]);
+    printf("sector %d not a bit subset, erasing, rewind to seq %u\r\n", sector, win_expected);
+    return BL_ERR_REWIND;
+}
+
+static void bl_op_data_handle(const bl_frame_t *frame)
+{
+    /* param: seq data -- 2 + n bytes */
+    const uint8_t *pbuf = frame->payload;
+
+    if (!session.active)
+    {
+        bl_seq_reject(BL_OPCODE_DATA, BL_ERR_PARAM);
+        return ;
+    }
+
+    uint16_t seq  = get_u16_le_inc(&pbuf);
+    uint32_t size = frame->length - 2u;
+
+    switch (bl_seq_check(seq))
+    {
+        case BL_SEQ_DUP:
+        {
+            bl_seq_response(BL_OPCODE_DATA, BL_ERR_OK);
+            return ;
+        }
+        case BL_SEQ_GAP:
+        {
+            bl_seq_reject(BL_OPCODE_DATA, BL_ERR_SEQ);
+            return ;
+        }
+        default:
+            break;
+    }
+
+    /* 同步写入的路径要等之前提交的帧都写完, 确认才能按序发出; 原地模式擦除冲突扇区时后续帧留在环中 */
+    if ((session.compress || session.patch || session.inplace) && bl_seq_inflight() != 0)
+    {
+        frame_retry = true;
+        return ;
+    }
+    if (session.inplace && session.sector_pending != 0)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    /*
+     * 压缩流/补丁流可在任意位置切帧, 输出长度由解码器或补丁按 size 限制。
+     * 输出交给 flash 任务队列异步编程, 确认表示已解码; 擦写失败由之后的 DATA 或 END 报告。
+     */
+    if (session.compress || session.patch)
+    {
+        if (!bl_session_out_ready())
+        {
+            frame_retry = true;
+            return ;
+        }
+
+        if (!bl_session_feed(pbuf, size))
+        {
+            session.active = false;
+            bl_session_out_release();
+            bl_seq_reject(BL_OPCODE_DATA,
+                          (session.erase_error || session.out_error) ? BL_ERR_UNKNOWN : BL_ERR_FORMAT);
+            return ;
+        }
+
+        bl_seq_advance();
+        bl_seq_response(BL_OPCODE_DATA, BL_ERR_OK);
+        return ;
+    }
+
+    uint32_t remain = session.size - session.offset;
+
+    /* 非最后一帧必须保持字对齐, 否则下一帧的起始地址不对齐 */
+    if (size > remain || (size < remain && (size & 0x3)))
+    {
+        bl_seq_reject(BL_OPCODE_DATA, BL_ERR_FORMAT);
+        return ;
+    }
+
+    if (session.inplace)
+    {
+        bl_err_t err = bl_session_write_inplace(seq, pbuf, size);
+        if (err == BL_ERR_REWIND)
+        {
+            /* 擦完再应答, 其间窗口内的后续帧静默丢弃 */
+            win_nak_sent = true;
+            return ;
+        }
+        if (err == BL_ERR_NEED_ERASE)
+        {
+            /* 同 REWIND, 会话到此结束, 主机必须收到 */
+            session.active = false;
+            win_nak_sent = true;
+            bl_seq_response(BL_OPCODE_DATA, err);
+            return ;
+        }
+        if (err != BL_ERR_OK)
+        {
+            bl_seq_reject(BL_OPCODE_DATA, err);
+            return ;
+        }
+    }
+    else
+    {
+        uint32_t addr = session.addr + session.offset;
+
+        if (flash_job_space() < BL_DATA_JOBS_MAX)
+        {
+            frame_retry = true;
+            return ;
+        }
+
+        if (!bl_session_prepare(addr, size))
+        {
+            bl_seq_reject(BL_OPCODE_DATA, BL_ERR_UNKNOWN);
+            return ;
+        }
+
+        /* 下一帧紧接着本帧写, 偏移在提交时推进, 编程失败时由完成回调回退 */
+        if (bl_seq_submit(frame, pbuf, addr, size))
+        {
+            session.offset += size;
+            bl_session_erase_ahead(flash_sector_index(addr + size - 1) + 1);
+        }
+        return ;
+    }
+
+    session.offset += size;
+    bl_seq_advance();
+    bl_seq_response(BL_OPCODE_DATA, BL_ERR_OK);
+}
+
+static void bl_op_end_handle(const bl_frame_t *frame)
+{
+    if (!session.active)
+    {
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    /* 差分模式要用区域擦除任务擦目标区域 */
+    if (session.patch && erase_job.active)
+    {
+        frame_retry = true;
+        return ;
+    }
+
+    flash_job_flush();
+
+    if (session.compress || session.patch)
+    {
+        bool ok = bl_session_finish();
+        bool written = bl_session_out_flush();
+
+        if (!ok || !written)
+        {
+            session.active = false;
+            bl_response_ack(BL_OPCODE_END, 1, ok ? BL_ERR_UNKNOWN : BL_ERR_FORMAT);
+            return ;
+        }
+    }
+
+    if (session.offset != session.size)
+    {
+        /* 解码器已收尾, 压缩/差分会话无法再续写 */
+        if (session.compress || session.patch)
+            session.active = false;
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_FORMAT);
+        return ;
+    }
+
+    /* 解压/补丁结果有误时不必再回读 flash, 差分模式下当前镜像也还完好 */
+    if ((session.compress || session.patch) && crc32_final(&session.out_crc) != session.crc32)
+    {
+        session.active = false;
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_VERIFY);
+        return ;
+    }
+
+    /* 差分模式: 擦除目标区域、拷贝、回读校验都在主循环中异步进行, 最后由 bl_verify_done_cb 应答 */
+    if (session.patch)
+    {
+        session.active = false;
+        bl_arginfo_invalidate();    // 上面已清空队列, 不会被推迟
+        bl_erase_job_start(BL_OPCODE_END, session.addr, session.size);
+        return ;
+    }
+
+    /* 主机收到 ACK 时 arginfo 已落盘, 即可 BOOT */
+    if (!bl_verify_start(BL_OPCODE_END, session.addr, session.size, session.crc32))
+    {
+        bl_response_ack(BL_OPCODE_END, 1, BL_ERR_OVERFLOW);
+        return ;
+    }
+
+    session.active = false;
+}
+
+/* 按扇区分块时块的结束位置为所在扇区的末尾 */
+static uint32_t bl_manifest_block_end(uint32_t addr)
+{
+    uint32_t end, start, size;
+
+    if (manifest.block != 0)
+        end = addr + manifest.block;
+    else if (flash_sector_info(flash_sector_index(addr), &start, &size))
+        end = start + size;
+    else
+        end = manifest.end;
+
+    return end < manifest.end ? end : manifest.end;
+}
+
+static void bl_manifest_send(void)
+{
+    uint8_t head[BL_MANIFEST_HEAD_LEN];
+    uint8_t data[BL_MANIFEST_BATCH * 4];
+
+    head[0] = BL_ERR_OK;
+    head[1] = (uint8_t)(manifest.total & 0xFF);
+    head[2] = (uint8_t)(manifest.total >> 8);
+    head[3] = (uint8_t)(manifest.first & 0xFF);
+    head[4] = (uint8_t)(manifest.first >> 8);
+
+    for (uint8_t i = 0; i < manifest.count; i++)
+    {
+        data[i * 4 + 0] = (uint8_t)(manifest.crc[i]);
+        data[i * 4 + 1] = (uint8_t)(manifest.crc[i] >> 8);
+        data[i * 4 + 2] = (uint8_t)(manifest.crc[i] >> 16);
+        data[i * 4 + 3] = (uint8_t)(manifest.crc[i] >> 24);
+    }
+
+    bl_response_long(BL_OPCODE_MANIFEST, head, sizeof(head), data, manifest.count * 4);
+
+    manifest.first += manifest.count;
+    manifest.count = 0;
+}
+
+static void bl_manifest_done_cb(uint32_t crc, void *arg)
+{
+    /* 与 READ 一样, 帧长不超过当前 MTU */
+    uint32_t batch = (parser.max_payload - BL_MANIFEST_HEAD_LEN) / 4;
+    if (batch > BL_MANIFEST_BATCH)
+        batch = BL_MANIFEST_BATCH;
+
+    manifest.crc[manifest.count++] = crc;
+    manifest.index++;
+    manifest.pending = false;
+
+    if (manifest.count >= batch || manifest.index == manifest.total)
+        bl_manifest_send();
+
+    if (manifest.index == manifest.total)
+        manifest.active = false;
+}
+
+/* 一次只算一块, CRC 单元空闲时才启动, 与 VERIFY 共用 */
+static void bl_manifest_poll(void)
+{
+    if (!manifest.active || manifest.pending || crc_hw_busy())
+        return ;
+
+    uint32_t end = bl_manifest_block_end(manifest.addr);
+
+    manifest.pending = true;
+    crc_hw_start((const uint8_t *)manifest.addr, end - manifest.addr, bl_manifest_done_cb, NULL);
+    manifest.addr = end;
+}
+
+static void bl_op_manifest_handle(const bl_frame_t *frame)
+{
+    /* param: addr size block -- 12 bytes */
+    const uint8_t *pbuf = frame->payload;
+
+    uint32_t addr  = get_u32_le_inc(&pbuf);
+    uint32_t size  = get_u32_le_inc(&pbuf);
+    uint32_t block = get_u32_le_inc(&pbuf);
+
+    if (!bl_flash_region_valid(addr, size) ||
+        (block != 0 && (block < BL_MANIFEST_BLOCK_MIN || (block & 0x3))))
+    {
+        bl_response_ack(BL_OPCODE_MANIFEST, 1, BL_ERR_PARAM);
+        return ;
+    }
+
+    if (manifest.active)
+    {
+        bl_response_ack(BL_OPCODE_MANIFEST, 1, BL_ERR_OVERFLOW);
+        return ;
+    }
+
+    manifest.addr  = addr;
+    manifest.end   = addr + size;
+    manifest.block = block;
+
+    /* 先数出总块数, 每帧都带上, 主机不需要知道扇区表 */
+    manifest.total = 0;
+    for (uint32_t a = addr; a < manifest.end; a = bl_manifest_block_end(a))
+        manifest.total++;
+
+    manifest.index   = 0;
+    manifest.first   = 0;
+    manifest.count   = 0;
+    manifest.pending = false;
+    manifest.active  = true;
+}
+
+static void bl_packet_handle(const bl_frame_t *frame)
+{
+    const bl_op_entry_t *op = bl_op_find(frame->opcode);
+
+    if (op == NULL)
+    {
+        bl_response_ack(frame->opcode, 1, BL_ERR_OPCODE);
+        return ;
+    }
+
+    if (frame->length < op->min_len || frame->length > op->max_len)
+    {
+        if (op->flags & BL_OP_FLAG_SEQ)
+            bl_seq_reject(op->opcode, BL_ERR_FORMAT);
+        else
+            bl_response_ack(op->opcode, 1, BL_ERR_FORMAT);
+        return ;
+    }
+
+    op->handler(frame);
+}
+
+/*
+ * arginfo 描述的正是 APP_ADDRESS 处的镜像, 向量表合理, 镜像开头与记录一致;
+ * 记录尚未完整校验或 full 为 true 时再对整个镜像算 CRC32, 结果记入状态, 以后的启动不必再算。
+ */
+static bool bl_boot_image_valid(bool full)
+{
+    const bl_arginfo_t *arginfo = bl_arginfo_image();
+    const uint32_t *vector = (const uint32_t *)APP_ADDRESS;
+
+    if (arginfo == NULL || arginfo->address != APP_ADDRESS)
+        return false;
+
+    /* 栈顶在 SRAM 或 CCM 内, 复位向量为 Thumb 地址且落在镜像内 */
+    uint32_t sp = vector[0];
+    uint32_t pc = vector[1];
+    if (!(sp - SRAM1_BASE <= 0x20000 || sp - CCMDATARAM_BASE <= 0x10000))
+        return false;
+    if (!(pc & 0x1) || (pc & ~0x1u) - APP_ADDRESS >= arginfo->length)
+        return false;
+
+    /* 抽查开头, 能发现调试器等绕过 bootloader 烧写的其他镜像 */
+    uint32_t sample = arginfo->length < ARGINFO_SAMPLE_SIZE ? arginfo->length : ARGINFO_SAMPLE_SIZE;
+    if (crc32((const uint8_t *)arginfo->address, sample) != arginfo->sample)
+        return false;
+
+    if (arginfo->state == ARGINFO_STATE_VALIDATED && !full)
+        return true;
+
+    bool ok = crc_hw_calc((const uint8_t *)arginfo->address, arginfo->length) == arginfo->crc32;
+    bl_arginfo_set_state_sync(arginfo, ok ? ARGINFO_STATE_VALIDATED : ARGINFO_STATE_INVALID);
+    printf("full image check: %s\r\n", ok ? "ok" : "failed");
+    return ok;
+}
+
+/* 监听窗口: ms 内收到帧头返回 true, 自动波特率模式下同时完成波特率检测 */
+static bool bl_boot_listen(uint32_t ms)
+{
+#if BL_UART_AUTOBAUD
+    uint32_t baudrate = bl_uart_autobaud(ms);
+    if (baudrate)
+        printf("autobaud: %lu\r\n", baudrate);
+    return baudrate != 0;
+#else
+    uint64_t start = cpu_get_ticks();
+
+    while (cpu_get_ticks() - start < (uint64_t)ms * TICKS_PER_MS)
+    {
+        const uint8_t *span;
+        uint32_t n = rb_peek_span(rx_rb, 0, &span);
+        if (n > 0 && memchr(span, BL_FRAME_HEADER, n) != NULL)
+            return true;
+    }
+    return false;
+#endif
+}
+
+/* 启动策略, 返回 true 表示留在 bootloader; host 为 true 表示主机已在监听窗口内发来帧头 */
+static bool bl_boot_policy(bool *host)
+{
+    *host = false;
+
+    bl_boot_bkp_access(true);
+    uint32_t request = RTC_ReadBackupRegister(BL_BOOT_REQ_BKP);
+    if (request == BL_BOOT_REQ_MAGIC || request == BL_BOOT_VERIFY_MAGIC)
+        RTC_WriteBackupRegister(BL_BOOT_REQ_BKP, 0);
+
+    bool stay = true;
+    if (request == BL_BOOT_REQ_MAGIC)
+        printf("update requested by app\r\n");
+    else if (!bl_boot_image_valid(request == BL_BOOT_VERIFY_MAGIC))
+        printf("no valid app\r\n");
+    else if (BL_BOOT_LISTEN_MS > 0 && bl_boot_listen(BL_BOOT_LISTEN_MS))
+        *host = true;
+    else
+        stay = false;
+
+    bl_boot_bkp_access(false);
+
+    if (stay)
+        printf("stay in bootloader, boot check: %lu us\r\n",
+               (cpu_get_cycles() - boot_start_cycles) / TICKS_PER_US);
+    return stay;
+}
+
+void bootloader_main(uint32_t boot_start)
+{
+    boot_start_cycles = boot_start;
+    printf("start bootloader\r\n");
+
+    rx_rb = rb_init((uint8_t *)rx_rb_buf, sizeof(rx_rb_buf));
+    if (!rx_rb)
+        return ;
+
+    bl_pool_init(&frame_pool, frame_pool_buf, PACKET_MAX_LENGTH, BL_FRAME_POOL_SLOTS);
+    bl_parser_init(&parser, rx_rb, &frame_pool, PACKET_PAYLOAD_DEFAULT_LENGTH, bl_opcode_check);
+    bl_parser_error_callback_register(&parser, bl_parser_crc_error_cb);
+
+    bl_uart_recv_block_callback_register(bl_uart_recv_cb);
+
+    bool host;
+    if (!bl_boot_policy(&host))
+        bl_boot_app(true);
+
+    flash_job_init();
+
+#if BL_UART_AUTOBAUD
+    /* 在第一个帧头上检测波特率, 不阻塞; 监听窗口内已检测过则跳过 */
+    if (!host)
+        bl_uart_autobaud_start();
+#endif
+
+    bl_frame_t frame;
+    uint32_t last_count = 0;
+    uint64_t last_byte_ticks = 0;
+    uint64_t now_ticks = 0;
+
+    while (1)
+    {
+        now_ticks = cpu_get_ticks();  // 循环开头统一更新时间
+
+        bl_baud_poll(now_ticks);
+        bl_read_poll();
+        crc_hw_poll();
+        bl_manifest_poll();
+        flash_job_poll();
+        bl_verify_poll();
+
+        /* 环内数据量变化即视为收到新字节, 刷新超时基准 */
+        uint32_t count = rb_count(rx_rb);
+        if (count != last_count)
+        {
+            last_count = count;
+            last_byte_ticks = now_ticks;
+        }
+
+#if BL_UART_AUTOBAUD
+        bl_autobaud_poll(now_ticks, last_byte_ticks);
+#endif
+
+        /* 交给 flash 任务队列的帧已转到池块, 这里的 release 不再有作用 */
+        if (bl_parser_poll(&parser, &frame))
+        {
+            frame_retry = false;
+            bl_packet_handle(&frame);
+            if (!frame_retry)
+                bl_parser_release(&parser);
+            continue;
+        }
+
+        if (bl_parser_pending(&parser) &&
+            (now_ticks - last_byte_ticks > TICKS_PER_MS * PACKET_RECV_BYTE_TIMEOUT))
+        {
+            bl_parser_reset(&parser);
+            last_byte_ticks = now_ticks;
+            printf("recv timeout\r\n");
         }
     }
 }
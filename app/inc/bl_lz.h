@@ -0,0 +1,55 @@
+#ifndef __BL_LZ_H__
+#define __BL_LZ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * 压缩流格式与 LZ4 block 相同, 由若干 sequence 组成:
+ *   | token | [lit_len 扩展] | literals | offset(2 byte LE) | [match_len 扩展] |
+ *   token 高 4 位为字面量长度, 低 4 位为匹配长度 - 4, 为 15 时后跟扩展字节, 直到某字节不为 255。
+ *   最后一个 sequence 只有字面量, 没有 offset。
+ * 限制: offset 不超过 BL_LZ_WINDOW_SIZE, 由主机工具 tools/bl_lz.py 保证。
+ * 解码器逐字节推进状态, 输入可以在任意位置被切成多帧。
+ */
+
+#define BL_LZ_WINDOW_SIZE       4096    // 历史窗口, 同时作为 flash 编程缓冲, 2 的幂
+#define BL_LZ_FLUSH_SIZE        1024    // 每攒满一段交给 flush 回调, 必须整除窗口
+#define BL_LZ_MIN_MATCH         4
+
+/* 输出一段解压数据, 返回 false 时解码终止 */
+typedef bool (*bl_lz_flush_t)(const uint8_t *data, uint32_t length, void *arg);
+
+typedef enum
+{
+    BL_LZ_TOKEN,
+    BL_LZ_LIT_LEN,
+    BL_LZ_LITERAL,
+    BL_LZ_OFF_LO,
+    BL_LZ_OFF_HI,
+    BL_LZ_MATCH_LEN,
+    BL_LZ_MATCH,
+    BL_LZ_ERROR
+} bl_lz_state_t;
+
+typedef struct
+{
+    uint8_t *window;
+    uint32_t pos;           // 已输出总字节数
+    uint32_t flushed;       // 已交给 flush 的字节数
+    uint32_t limit;         // 输出上限, 超出视为数据错误
+    bl_lz_flush_t flush;
+    void *arg;
+
+    bl_lz_state_t state;
+    bool match_ext;         // token 低 4 位为 15, 匹配长度有扩展字节
+    uint32_t lit_len;
+    uint32_t match_len;
+    uint32_t offset;
+} bl_lz_t;
+
+void bl_lz_init(bl_lz_t *lz, uint8_t *window, uint32_t limit, bl_lz_flush_t flush, void *arg);
+bool bl_lz_feed(bl_lz_t *lz, const uint8_t *in, uint32_t length);
+bool bl_lz_finish(bl_lz_t *lz);
+
+#endif /* __BL_LZ_H__ */
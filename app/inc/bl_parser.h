@@ -0,0 +1,66 @@
+#ifndef __BL_PARSER_H__
+#define __BL_PARSER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ringbuffer.h"
+#include "crc16.h"
+#include "bl_pool.h"
+
+#define BL_FRAME_HEADER         0xAA
+#define BL_FRAME_HEAD_LEN       4       // header + opcode + length
+#define BL_FRAME_CRC_LEN        2
+#define BL_FRAME_OVERHEAD       (BL_FRAME_HEAD_LEN + BL_FRAME_CRC_LEN)
+
+typedef enum
+{
+    BL_PARSER_HUNT,         // 查找帧头
+    BL_PARSER_HEAD,         // 等待 opcode + length
+    BL_PARSER_BODY,         // 等待 payload + crc
+    BL_PARSER_READY         // 完整帧待处理
+} bl_parser_state_t;
+
+/* payload 指向接收环 (不跨环尾时) 或从块池借来的帧缓冲, 在 bl_parser_release 之前有效 */
+typedef struct
+{
+    uint8_t opcode;
+    uint16_t length;
+    const uint8_t *payload;
+} bl_frame_t;
+
+/* 帧头阶段的快速过滤, 返回 false 时丢弃该帧头重新同步 */
+typedef bool (*bl_parser_check_t)(uint8_t opcode, uint16_t length);
+
+/* 帧头合法但 CRC 错误时通知上层, 用于立即 NAK 触发重传 */
+typedef void (*bl_parser_error_t)(uint8_t opcode, uint16_t length);
+
+typedef struct
+{
+    rb_t rb;
+    bl_pool_t *pool;        // 跨环尾的帧和 bl_parser_detach 从这里借缓冲
+    uint8_t *slot;          // 当前帧占用的块, 帧在环内时为 NULL
+    uint16_t max_payload;
+    bl_parser_check_t check;
+    bl_parser_error_t on_crc_error;
+
+    bl_parser_state_t state;
+    uint8_t opcode;
+    uint16_t length;
+    uint32_t frame_len;
+    crc16_ctx_t crc;        // 随数据到达逐段累加
+    uint32_t crc_pos;       // 已计入 CRC 的帧内偏移
+    bl_frame_t frame;
+} bl_parser_t;
+
+void bl_parser_init(bl_parser_t *parser, rb_t rb, bl_pool_t *pool,
+                    uint16_t max_payload, bl_parser_check_t check);
+uint16_t bl_parser_set_max_payload(bl_parser_t *parser, uint16_t max_payload);
+void bl_parser_error_callback_register(bl_parser_t *parser, bl_parser_error_t cb);
+bool bl_parser_poll(bl_parser_t *parser, bl_frame_t *frame);
+void bl_parser_release(bl_parser_t *parser);
+uint8_t *bl_parser_detach(bl_parser_t *parser, bl_frame_t *frame);
+bool bl_parser_pending(const bl_parser_t *parser);
+void bl_parser_reset(bl_parser_t *parser);
+void bl_parser_flush(bl_parser_t *parser);
+
+#endif /* __BL_PARSER_H__ */
@@ -0,0 +1,58 @@
+#ifndef __BL_PATCH_H__
+#define __BL_PATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * 差分补丁格式 (bsdiff 式), 由若干记录组成:
+ *   | diff_len | extra_len | seek | diff (diff_len byte) | extra (extra_len byte) |
+ *   三个控制字段为 LEB128 变长整数, seek 为 zigzag 编码的有符号数。
+ *   diff:  输出 = 源[src_pos + i] + diff[i] (模 256), 之后 src_pos += diff_len
+ *   extra: 原样输出
+ *   最后 src_pos += seek, 必须仍在源镜像范围内。
+ * 源镜像只读不写, 输出经缓冲后交给 flush 回调; 输入可以在任意位置被切成多帧。
+ * 主机工具为 tools/bl_patch.py。
+ */
+
+#define BL_PATCH_VARINT_MAX     5       // 32 bit LEB128 最多 5 字节
+
+/* 输出一段补丁结果, 返回 false 时应用终止 */
+typedef bool (*bl_patch_flush_t)(const uint8_t *data, uint32_t length, void *arg);
+
+typedef enum
+{
+    BL_PATCH_CTRL,
+    BL_PATCH_DIFF,
+    BL_PATCH_EXTRA,
+    BL_PATCH_ERROR
+} bl_patch_state_t;
+
+typedef struct
+{
+    const uint8_t *src;
+    uint32_t src_size;
+    uint32_t src_pos;
+
+    uint8_t *buf;           // 输出缓冲, 满了才 flush, 因此除最后一段外长度都是 buf_size
+    uint32_t buf_size;
+    uint32_t buf_len;
+    uint32_t out_total;     // 已生成的输出长度 (含缓冲中未 flush 的)
+    uint32_t limit;         // 输出上限
+    bl_patch_flush_t flush;
+    void *arg;
+
+    bl_patch_state_t state;
+    uint8_t field;          // 正在解析的控制字段 0~2
+    uint8_t varint_len;
+    uint32_t varint;
+    uint32_t ctrl[3];       // diff_len, extra_len, seek (zigzag)
+    uint32_t src_next;      // 本条记录结束后的 src_pos
+} bl_patch_t;
+
+void bl_patch_init(bl_patch_t *patch, const uint8_t *src, uint32_t src_size,
+                   uint8_t *buf, uint32_t buf_size, uint32_t limit, bl_patch_flush_t flush, void *arg);
+bool bl_patch_feed(bl_patch_t *patch, const uint8_t *in, uint32_t length);
+bool bl_patch_finish(bl_patch_t *patch);
+
+#endif /* __BL_PATCH_H__ */
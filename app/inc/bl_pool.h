@@ -0,0 +1,39 @@
+#ifndef __BL_POOL_H__
+#define __BL_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * 定长块池: 所有块大小相同, 空闲块串成单链表, 链表指针就存放在空闲块的头部,
+ * 分配/释放都只动表头, O(1), 不使用堆。
+ * 分配和释放在短临界区内完成, 可以在中断 (如 DMA 发送完成回调) 中释放。
+ */
+
+/* 块大小向上取整到 4 字节, 保证每块都能按字对齐存放链表指针 */
+#define BL_POOL_SLOT_ALIGN(size)        (((size) + 3u) & ~3u)
+#define BL_POOL_STORAGE_WORDS(size, n)  (BL_POOL_SLOT_ALIGN(size) / 4 * (n))
+
+typedef struct bl_pool_node
+{
+    struct bl_pool_node *next;
+} bl_pool_node_t;
+
+typedef struct
+{
+    bl_pool_node_t *free_list;
+    uint8_t *base;
+    uint32_t slot_size;
+    uint16_t slot_num;
+    volatile uint16_t used;
+    uint16_t high_water;    // used 出现过的最大值
+} bl_pool_t;
+
+/* storage 须按字对齐, 大小至少为 BL_POOL_STORAGE_WORDS(slot_size, slot_num) 个字 */
+void bl_pool_init(bl_pool_t *pool, uint32_t *storage, uint32_t slot_size, uint16_t slot_num);
+void *bl_pool_alloc(bl_pool_t *pool);
+void bl_pool_free(bl_pool_t *pool, void *slot);
+uint16_t bl_pool_used(const bl_pool_t *pool);
+uint16_t bl_pool_high_water(const bl_pool_t *pool);
+
+#endif /* __BL_POOL_H__ */
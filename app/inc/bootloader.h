@@ -4,7 +4,26 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * 启动策略: arginfo 有效且 APP_ADDRESS 处的镜像校验通过时自动跳转到 app,
+ * 以下任一情况留在 bootloader 等待升级:
+ *   - 没有有效的 arginfo 或镜像
+ *   - app 在 RTC 备份寄存器 BKP0R 写入 BL_BOOT_REQ_MAGIC 后软复位 (读到后清除)
+ *   - 跳转前的监听窗口 BL_BOOT_LISTEN_MS 内主机发来帧头 0xAA
+ * 自动跳转时把从 main 开始到跳转的耗时 (us) 写入 BKP1R, DWT 周期计数器不停止。
+ *
+ * 镜像完整校验一次后状态记在 arginfo 中, 之后的启动只检查向量表和镜像开头, 不再算整个镜像的 CRC32;
+ * 通过 bootloader 擦写 APP 区后恢复为下次启动完整校验。app 怀疑自身被改动时可写入
+ * BL_BOOT_VERIFY_MAGIC 后软复位, bootloader 完整校验一次, 通过则照常跳转。
+ */
+#ifndef BL_BOOT_LISTEN_MS
+#define BL_BOOT_LISTEN_MS       5       // 0: 镜像有效时立即跳转, 只能由 app 请求进入升级
+#endif
 
-void bootloader_main(void);
+#define BL_BOOT_REQ_MAGIC       0x5AA5B007
+#define BL_BOOT_VERIFY_MAGIC    0x5AA5C3C3
+
+
+void bootloader_main(uint32_t boot_start);
 
 #endif /* __BOOTLOADER_H__ */
@@ -3,6 +3,23 @@
 
 #define ARRAY_SIZE(arr)  (sizeof(arr) / sizeof((arr)[0]))
 
+/* 放入 CCM (0x10000000, 64K), 由 scatter 的 RW_IRAM2 收集, 上电不清零。
+ * CCM 只挂在 D-Bus 上, DMA 访问不到, DMA 收发缓冲不能使用 */
+#if defined(__CC_ARM)
+#define BL_CCM_DATA      __attribute__((section(".bss.ccm"), zero_init))
+#else
+#define BL_CCM_DATA      __attribute__((section(".bss.ccm")))
+#endif
+
+/*
+ * 1: 向量表拷贝到 SRAM 并重定位 VTOR, 热路径代码由 scatter 放到 SRAM 执行,
+ * flash 擦写期间中断和主循环都不会因取指而停顿。
+ * 须同时在链接选项中定义同名宏, 见 mdk/Objects/boot_new_.sct。
+ */
+#ifndef BL_RUN_FROM_RAM
+#define BL_RUN_FROM_RAM  0
+#endif
+
 
 
 #endif /* __MAIN_H__ */
@@ -3,16 +3,27 @@
 #include "main.h"
 #include "board.h"
 #include "bl_uart.h"
+#include "cpu_tick.h"
+#include "crc16.h"
+#include "crc32.h"
 #include "bootloader.h"
 int main()
 {
+    /* 启动计时起点, 到跳转 app 或进入升级模式为止 */
+    cpu_cycles_init();
+    uint32_t boot_start = cpu_get_cycles();
 
     board_init();
 
+    cpu_tick_init();
+
+    crc16_tables_init();
+    crc32_tables_init();
+
     bl_uart_init();
 
     printf("hellow world\r\n");
-    bootloader_main();
+    bootloader_main(boot_start);
 
     while (1)
     {
@@ -1,8 +1,104 @@
 #include <stddef.h>
 #include "stm32f4xx.h"
 #include "bl_uart.h"
+#include "uart.h"
+#include "uart_tx.h"
+#include "cpu_tick.h"
 
 bl_uart_recv_callback_t bl_uart_recv_callback = NULL;
+bl_uart_recv_block_callback_t bl_uart_recv_block_callback = NULL;
+
+static volatile uint32_t rx_errors = 0;         // 帧错误和噪声计数
+static volatile uint32_t autobaud_result = 0;   // 检测到的波特率, 由 bl_uart_autobaud_poll 取走
+
+#if BL_UART_RX_DMA
+/* USART1_RX: DMA2 Stream2 Channel4 */
+#define BL_UART_RX_DMA_STREAM       DMA2_Stream2
+#define BL_UART_RX_DMA_CHANNEL      DMA_Channel_4
+#define BL_UART_RX_DMA_IRQn         DMA2_Stream2_IRQn
+
+static uint8_t rx_dma_buf[BL_UART_RX_DMA_BUF_SIZE];
+static uint16_t rx_dma_pos = 0;     // 已上报到的位置
+#endif
+
+static void bl_uart_publish(const uint8_t *data, uint16_t length)
+{
+    if (bl_uart_recv_block_callback)
+    {
+        bl_uart_recv_block_callback(data, length);
+    }
+    else if (bl_uart_recv_callback)
+    {
+        for (uint16_t i = 0; i < length; i++)
+            bl_uart_recv_callback(data[i]);
+    }
+}
+
+#if BL_UART_RX_DMA
+static void bl_uart_rx_dma_config(void)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+    NVIC_InitTypeDef NVIC_InitStructure;
+
+    DMA_DeInit(BL_UART_RX_DMA_STREAM);
+    while (DMA_GetCmdStatus(BL_UART_RX_DMA_STREAM) != DISABLE);
+
+    DMA_StructInit(&DMA_InitStructure);
+    DMA_InitStructure.DMA_Channel = BL_UART_RX_DMA_CHANNEL;
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&USART1->DR;
+    DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)rx_dma_buf;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
+    DMA_InitStructure.DMA_BufferSize = BL_UART_RX_DMA_BUF_SIZE;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+    DMA_Init(BL_UART_RX_DMA_STREAM, &DMA_InitStructure);
+
+    rx_dma_pos = 0;
+
+    DMA_ITConfig(BL_UART_RX_DMA_STREAM, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+    NVIC_InitStructure.NVIC_IRQChannel = BL_UART_RX_DMA_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 5;  // 与 USART1 同级, 保证 drain 不重入
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+    /* 接收改由 DMA 搬运, 只保留 IDLE 中断用于分帧, 以及错误中断用于统计帧错误和噪声 */
+    USART_ITConfig(USART1, USART_IT_RXNE, DISABLE);
+    USART_ITConfig(USART1, USART_IT_IDLE, ENABLE);
+    USART_ITConfig(USART1, USART_IT_ERR, ENABLE);
+    USART_DMACmd(USART1, USART_DMAReq_Rx, ENABLE);
+
+    DMA_Cmd(BL_UART_RX_DMA_STREAM, ENABLE);
+}
+
+/* 将 DMA 写指针之前、尚未上报的字节按连续段交给上层 */
+static void bl_uart_rx_dma_drain(void)
+{
+    uint16_t pos = BL_UART_RX_DMA_BUF_SIZE - DMA_GetCurrDataCounter(BL_UART_RX_DMA_STREAM);
+
+    if (pos == rx_dma_pos)
+        return ;
+
+    if (pos > rx_dma_pos)
+    {
+        bl_uart_publish(&rx_dma_buf[rx_dma_pos], pos - rx_dma_pos);
+    }
+    else
+    {
+        bl_uart_publish(&rx_dma_buf[rx_dma_pos], BL_UART_RX_DMA_BUF_SIZE - rx_dma_pos);
+        if (pos)
+            bl_uart_publish(&rx_dma_buf[0], pos);
+    }
+
+    rx_dma_pos = (pos == BL_UART_RX_DMA_BUF_SIZE) ? 0 : pos;
+}
+#endif
 
 void bl_uart_init(void)
 {
@@ -13,6 +109,33 @@ void bl_uart_init(void)
     uart_gpio_config();
     uart_it_config();
     uart_lowlevel_init();
+    uart_tx_init();
+
+#if BL_UART_RX_DMA
+    bl_uart_rx_dma_config();
+#endif
+}
+
+void bl_uart_deinit(void)
+{
+    extern void uart_deinit(void);
+
+#if BL_UART_AUTOBAUD
+    uart_autobaud_stop(UART_PORT_BL);
+#endif
+
+#if BL_UART_RX_DMA
+    USART_DMACmd(USART1, USART_DMAReq_Rx, DISABLE);
+    USART_ITConfig(USART1, USART_IT_IDLE, DISABLE);
+    USART_ITConfig(USART1, USART_IT_ERR, DISABLE);
+    DMA_Cmd(BL_UART_RX_DMA_STREAM, DISABLE);
+    DMA_DeInit(BL_UART_RX_DMA_STREAM);
+    NVIC_DisableIRQ(BL_UART_RX_DMA_IRQn);
+    NVIC_ClearPendingIRQ(BL_UART_RX_DMA_IRQn);
+#endif
+
+    uart_tx_deinit();
+    uart_deinit();
 }
 
 void bl_uart_recv_callback_register(bl_uart_recv_callback_t cb)
@@ -20,22 +143,152 @@ void bl_uart_recv_callback_register(bl_uart_recv_callback_t cb)
     bl_uart_recv_callback = cb;
 }
 
+void bl_uart_recv_block_callback_register(bl_uart_recv_block_callback_t cb)
+{
+    bl_uart_recv_block_callback = cb;
+}
+
 void bl_uart_send(uint8_t *data, uint16_t length)
 {
-    for (uint16_t i = 0; i < length; i++) {
-        while (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET);
-        USART_SendData(USART1, data[i]);
+    uart_tx_write(UART_PORT_BL, data, length);
+}
+
+bool bl_uart_send_async(const uint8_t *data, uint16_t length, bl_uart_send_callback_t cb, void *arg)
+{
+    return uart_tx_submit(UART_PORT_BL, data, length, cb, arg);
+}
+
+void bl_uart_flush(void)
+{
+    uart_tx_flush(UART_PORT_BL);
+}
+
+bool bl_uart_check_baudrate(uint32_t baudrate)
+{
+    return uart_baudrate_check(UART_PORT_BL, baudrate);
+}
+
+/* 先把旧波特率下排队的数据发完再切换 */
+bool bl_uart_set_baudrate(uint32_t baudrate)
+{
+    if (!uart_baudrate_check(UART_PORT_BL, baudrate))
+        return false;
+
+    uart_tx_flush(UART_PORT_BL);
+    return uart_set_baudrate(UART_PORT_BL, baudrate);
+}
+
+uint32_t bl_uart_get_baudrate(void)
+{
+    return uart_get_baudrate(UART_PORT_BL);
+}
+
+/* 开始在下一个帧头 0xAA 上检测波特率, 不阻塞; 结果由 bl_uart_autobaud_poll 取走 */
+void bl_uart_autobaud_start(void)
+{
+    autobaud_result = 0;
+    uart_autobaud_start(UART_PORT_BL);
+}
+
+void bl_uart_autobaud_stop(void)
+{
+    uart_autobaud_stop(UART_PORT_BL);
+}
+
+bool bl_uart_autobaud_active(void)
+{
+    return uart_autobaud_active(UART_PORT_BL);
+}
+
+/* 检测完成后返回一次新波特率, 否则返回 0 */
+uint32_t bl_uart_autobaud_poll(void)
+{
+    uint32_t baudrate = autobaud_result;
+
+    if (baudrate)
+        autobaud_result = 0;
+    return baudrate;
+}
+
+/* 阻塞检测, 最多等待 timeout_ms (0 表示一直等待), 超时后停止检测并恢复接收 */
+uint32_t bl_uart_autobaud(uint32_t timeout_ms)
+{
+    uint64_t start = cpu_get_ticks();
+    uint32_t baudrate;
+
+    bl_uart_autobaud_start();
+    while ((baudrate = bl_uart_autobaud_poll()) == 0)
+    {
+        if (timeout_ms && cpu_get_ticks() - start >= (uint64_t)timeout_ms * TICKS_PER_MS)
+        {
+            bl_uart_autobaud_stop();
+            break;
+        }
     }
-    while (USART_GetFlagStatus(USART1, USART_FLAG_TC) == RESET);
+    return baudrate;
+}
+
+/* 启动以来的帧错误和噪声次数, 波特率不对时会持续增加 */
+uint32_t bl_uart_rx_errors(void)
+{
+    return rx_errors;
 }
 
 void USART1_IRQHandler(void)
 {
+#if BL_UART_RX_DMA
+    uint32_t sr = USART1->SR;
+
+    if (sr & (USART_SR_IDLE | USART_SR_FE | USART_SR_NE))
+    {
+        /* 读 SR 再读 DR 清除 IDLE 和错误标志 (同时清除 ORE) */
+        (void)USART1->DR;
+        if (sr & (USART_SR_FE | USART_SR_NE))
+            rx_errors++;
+        bl_uart_rx_dma_drain();
+    }
+#else
     if(USART_GetITStatus(USART1, USART_IT_RXNE) != RESET)
     {
+        if (USART1->SR & (USART_SR_FE | USART_SR_NE))
+            rx_errors++;
         uint8_t data = USART_ReceiveData(USART1);
-        if (bl_uart_recv_callback)
-            bl_uart_recv_callback(data);
+        bl_uart_publish(&data, 1);
         USART_ClearITPendingBit(USART1, USART_IT_RXNE);
     }
+#endif
+}
+
+#if BL_UART_AUTOBAUD
+/* USART1 RX (PA10) 下降沿: 检测成功后把被测量消耗掉的帧头补交给上层, 解析器照常从帧头开始 */
+void EXTI15_10_IRQHandler(void)
+{
+    uint32_t baudrate = uart_autobaud_edge(UART_PORT_BL);
+
+    if (baudrate)
+    {
+        uint8_t sync = BL_UART_AUTOBAUD_SYNC;
+
+        /* 与接收中断互斥, 保证帧头排在后续字节之前 */
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        bl_uart_publish(&sync, 1);
+        __set_PRIMASK(primask);
+
+        autobaud_result = baudrate;
+    }
+}
+#endif
+
+#if BL_UART_RX_DMA
+void DMA2_Stream2_IRQHandler(void)
+{
+    if (DMA_GetITStatus(BL_UART_RX_DMA_STREAM, DMA_IT_HTIF2) != RESET)
+        DMA_ClearITPendingBit(BL_UART_RX_DMA_STREAM, DMA_IT_HTIF2);
+
+    if (DMA_GetITStatus(BL_UART_RX_DMA_STREAM, DMA_IT_TCIF2) != RESET)
+        DMA_ClearITPendingBit(BL_UART_RX_DMA_STREAM, DMA_IT_TCIF2);
+
+    bl_uart_rx_dma_drain();
 }
+#endif
@@ -2,11 +2,42 @@
 #define __BL_UART_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+
+/* 1: USART1 接收走 DMA2 Stream2 循环缓冲 + IDLE 分帧, 0: 每字节 RXNE 中断 */
+#ifndef BL_UART_RX_DMA
+#define BL_UART_RX_DMA              1
+#endif
+
+/* DMA 循环缓冲大小, HT/TC 中断各在一半处触发一次 */
+#define BL_UART_RX_DMA_BUF_SIZE     256
+
+/* 1: 在帧头 0xAA 上自动检测主机波特率, 接收空闲或出现帧错误/噪声后由上层重新开始检测 */
+#ifndef BL_UART_AUTOBAUD
+#define BL_UART_AUTOBAUD            1
+#endif
+
+#define BL_UART_AUTOBAUD_SYNC       0xAA
 
 typedef void (*bl_uart_recv_callback_t)(uint8_t data);
+typedef void (*bl_uart_recv_block_callback_t)(const uint8_t *data, uint16_t length);
+typedef void (*bl_uart_send_callback_t)(void *arg);
 
 void bl_uart_init(void);
+void bl_uart_deinit(void);
 void bl_uart_recv_callback_register(bl_uart_recv_callback_t cb);
+void bl_uart_recv_block_callback_register(bl_uart_recv_block_callback_t cb);
 void bl_uart_send(uint8_t *data, uint16_t length);
+bool bl_uart_send_async(const uint8_t *data, uint16_t length, bl_uart_send_callback_t cb, void *arg);
+void bl_uart_flush(void);
+bool bl_uart_check_baudrate(uint32_t baudrate);
+bool bl_uart_set_baudrate(uint32_t baudrate);
+uint32_t bl_uart_get_baudrate(void);
+void bl_uart_autobaud_start(void);
+void bl_uart_autobaud_stop(void);
+bool bl_uart_autobaud_active(void);
+uint32_t bl_uart_autobaud_poll(void);
+uint32_t bl_uart_autobaud(uint32_t timeout_ms);
+uint32_t bl_uart_rx_errors(void);
 
 #endif /* __BL_UART_H__*/
@@ -24,16 +24,16 @@ void cpu_tick_deinit(void)
 
 void delay_ms(uint32_t ms)
 {
-    uint64_t start = get_cur_tick();
+    uint64_t start = cpu_get_ticks();
 
-    while ((get_cur_tick() - start) < ms * TICKS_PER_MS);
+    while ((cpu_get_ticks() - start) < (uint64_t)ms * TICKS_PER_MS);
 }
 
 void delay_us(uint32_t us)
 {
-    uint64_t start = get_cur_tick();
+    uint64_t start = cpu_get_ticks();
 
-    while ((get_cur_tick() - start) < us * TICKS_PER_US);
+    while ((cpu_get_ticks() - start) < (uint64_t)us * TICKS_PER_US);
 }
 
 uint64_t cpu_get_ticks(void)
@@ -48,7 +48,23 @@ uint64_t cpu_get_ticks(void)
     return ret;
 }
 
-void Systick_Handler(void)
+/* DWT 周期计数器, 用于比 1ms 更细的计时 (如自动波特率测量、启动耗时); 已在计数时不清零 */
+void cpu_cycles_init(void)
+{
+    if ((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+        return ;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t cpu_get_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+void SysTick_Handler(void)
 {
     g_ticks += TICKS_PER_MS;
 }
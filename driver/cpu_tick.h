@@ -11,5 +11,7 @@ void cpu_tick_deinit(void);
 void delay_ms(uint32_t ms);
 void delay_us(uint32_t us);
 uint64_t cpu_get_ticks(void);
+void cpu_cycles_init(void);
+uint32_t cpu_get_cycles(void);
 
 #endif /* __CPU_TICK_H__ */
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include "stm32f4xx.h"
+#include "crc32.h"
+#include "crc_hw.h"
+
+/*
+ * F4 的 CRC 单元固定为 CRC-32/MPEG-2: 多项式 0x04C11DB7, 初值 0xFFFFFFFF,
+ * 按 32 位字 MSB 先行, 不反射, 不异或输出, 也不能设置初值。
+ * IEEE/zlib CRC32 是反射算法, 把每个小端字 RBIT 后写入即等价于 LSB 先行,
+ * 此时 RBIT(DR) 就是反射算法的中间状态, 末尾不足一个字的字节交给软件
+ * crc32_update 接着算, 最后异或 0xFFFFFFFF。
+ * DMA 无法在搬运时做位反转, 所以由 CPU 分块喂数据 (LDR + RBIT + STR),
+ * 每次 poll 只处理 CRC_HW_CHUNK_SIZE 字节, 主循环仍能及时处理串口。
+ * 起始地址不是字对齐时无法进入硬件, 整个任务退回软件分块计算。
+ */
+
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t remain;
+    bool busy;
+    bool soft;              // 起始地址未对齐, 全程软件计算
+    crc32_ctx_t ctx;        // soft 模式的状态
+    crc_hw_done_cb_t cb;
+    void *arg;
+} crc_hw_job_t;
+
+static crc_hw_job_t job;
+
+bool crc_hw_start(const uint8_t *data, uint32_t length, crc_hw_done_cb_t cb, void *arg)
+{
+    if (job.busy)
+        return false;
+
+    job.data   = data;
+    job.remain = length;
+    job.soft   = ((uint32_t)data & 0x3) != 0;
+    job.cb     = cb;
+    job.arg    = arg;
+    job.busy   = true;
+
+    crc32_init(&job.ctx);
+    CRC_ResetDR();
+    return true;
+}
+
+bool crc_hw_busy(void)
+{
+    return job.busy;
+}
+
+void crc_hw_poll(void)
+{
+    if (!job.busy)
+        return ;
+
+    uint32_t n = job.remain < CRC_HW_CHUNK_SIZE ? job.remain : CRC_HW_CHUNK_SIZE;
+
+    if (job.soft)
+    {
+        crc32_update(&job.ctx, job.data, n);
+    }
+    else
+    {
+        const uint32_t *word = (const uint32_t *)job.data;
+
+        n &= ~0x3u;
+        for (uint32_t i = 0; i < n / 4; i++)
+            CRC->DR = __RBIT(word[i]);
+
+        /* 只剩不足一个字: 取出中间状态交给软件收尾 */
+        if (n == 0)
+        {
+            job.ctx.crc = __RBIT(CRC->DR);
+            job.soft = true;
+            return ;
+        }
+    }
+
+    job.data   += n;
+    job.remain -= n;
+
+    if (job.remain > 0)
+        return ;
+
+    uint32_t crc = job.soft ? crc32_final(&job.ctx) : (__RBIT(CRC->DR) ^ 0xFFFFFFFF);
+
+    job.busy = false;
+    if (job.cb)
+        job.cb(crc, job.arg);
+}
+
+static void crc_hw_sync_done(uint32_t crc, void *arg)
+{
+    *(uint32_t *)arg = crc;
+}
+
+/* 同步版本, 运行期间独占 CRC 单元 */
+uint32_t crc_hw_calc(const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = 0;
+
+    while (!crc_hw_start(data, length, crc_hw_sync_done, &crc))
+        crc_hw_poll();
+
+    while (crc_hw_busy())
+        crc_hw_poll();
+
+    return crc;
+}
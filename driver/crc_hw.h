@@ -0,0 +1,18 @@
+#ifndef __CRC_HW_H__
+#define __CRC_HW_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 每次 crc_hw_poll 处理的字节数, 决定主循环被占用的最长时间 */
+#define CRC_HW_CHUNK_SIZE       4096
+
+/* 完成回调, 在 crc_hw_poll 的调用上下文 (主循环) 中执行, crc 与 zlib crc32() 一致 */
+typedef void (*crc_hw_done_cb_t)(uint32_t crc, void *arg);
+
+bool crc_hw_start(const uint8_t *data, uint32_t length, crc_hw_done_cb_t cb, void *arg);
+bool crc_hw_busy(void);
+void crc_hw_poll(void);
+uint32_t crc_hw_calc(const uint8_t *data, uint32_t length);
+
+#endif /* __CRC_HW_H__ */
@@ -1,9 +1,32 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "main.h"
 #include "flash_ops.h"
 #include "stm32f4xx.h"
 
+#if FLASH_VOLTAGE_RANGE == 4
+#define FLASH_ERASE_RANGE       VoltageRange_4
+#define FLASH_ERASE_PSIZE       FLASH_PSIZE_DOUBLE_WORD
+#define FLASH_PROGRAM_X64       1
+#elif FLASH_VOLTAGE_RANGE == 3
+#define FLASH_ERASE_RANGE       VoltageRange_3
+#define FLASH_ERASE_PSIZE       FLASH_PSIZE_WORD
+#define FLASH_PROGRAM_X64       0
+#else
+#error "FLASH_VOLTAGE_RANGE must be 3 or 4"
+#endif
+
+#define FLASH_SR_ERRORS         (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+#define FLASH_CR_IRQS           (FLASH_IT_EOP | FLASH_IT_ERR)
+
+/* 编程循环放在 RAM (scatter 中 RW_IRAM1 收集 RAMCODE), 等待编程完成时不取 flash 指令 */
+#if defined(__CC_ARM)
+#define FLASH_RAMFUNC           __attribute__((section("RAMCODE")))
+#else
+#define FLASH_RAMFUNC
+#endif
+
 typedef struct sector
 {
     uint32_t sector_number;
@@ -27,6 +50,40 @@ static const sector_t sectors[] =
     {FLASH_Sector_11, 0x080E0000, 128 * 1024}
 };
 
+/*
+ * 异步任务队列: 主循环在 job_tail 提交, FLASH 中断在 job_run 推进硬件,
+ * 主循环在 job_head 取走完成的任务并回调。索引自由递增, head <= run <= tail。
+ * 中断只写寄存器; 擦除前的空扇区检查要读整个扇区, 由主循环在该任务排到最前时进行。
+ */
+#define FLASH_JOB_MASK          (FLASH_JOB_QUEUE_DEPTH - 1)
+
+typedef enum
+{
+    FLASH_JOB_ERASE,
+    FLASH_JOB_PROGRAM
+} flash_job_type_t;
+
+typedef struct
+{
+    flash_job_type_t type;
+    flash_job_status_t status;
+    int sector;                 // 擦除
+    bool checked;               // 擦除: 已在主循环中做过空扇区检查
+    uint32_t addr;              // 编程: 下一个字的地址
+    const uint8_t *data;
+    uint32_t remain;
+    flash_job_cb_t cb;
+    void *arg;
+} flash_job_t;
+
+typedef char flash_job_depth_check[(FLASH_JOB_QUEUE_DEPTH & FLASH_JOB_MASK) == 0 ? 1 : -1];
+
+static flash_job_t jobs[FLASH_JOB_QUEUE_DEPTH];
+static uint8_t job_head = 0;
+static volatile uint8_t job_run = 0;
+static volatile uint8_t job_tail = 0;
+static volatile bool job_busy = false;      // jobs[job_run] 的擦写正在进行, 完成时进中断
+
 void flash_lock(void)
 {
     FLASH_Lock();
@@ -37,8 +94,50 @@ void flash_unlock(void)
     FLASH_Unlock();
 }
 
-bool flash_erase(uint32_t addr, uint32_t length)
+/* 每组 8 个字先相与再比较 (编译为 LDM 连续读取), 遇到非 0xFF 立即返回 */
+bool flash_is_blank(uint32_t addr, uint32_t length)
 {
+    const uint8_t *p8 = (const uint8_t *)addr;
+
+    for (; length > 0 && ((uint32_t)p8 & 0x3); length--)
+    {
+        if (*p8++ != 0xFF)
+            return false;
+    }
+
+    const uint32_t *p = (const uint32_t *)p8;
+    for (; length >= 32; length -= 32, p += 8)
+    {
+        if ((p[0] & p[1] & p[2] & p[3] & p[4] & p[5] & p[6] & p[7]) != 0xFFFFFFFF)
+            return false;
+    }
+
+    for (; length >= 4; length -= 4)
+    {
+        if (*p++ != 0xFFFFFFFF)
+            return false;
+    }
+
+    for (p8 = (const uint8_t *)p; length > 0; length--)
+    {
+        if (*p8++ != 0xFF)
+            return false;
+    }
+
+    return true;
+}
+
+/* 擦除与 [addr, addr + length) 重叠的扇区, 已是全 0xFF 的扇区跳过; report 可为 NULL */
+bool flash_erase(uint32_t addr, uint32_t length, flash_erase_report_t *report)
+{
+    flash_job_wait();
+
+    if (report)
+    {
+        report->erased  = 0;
+        report->skipped = 0;
+    }
+
     flash_unlock();
 
     uint32_t sector_start_addr = 0, sector_end_addr = 0;
@@ -50,41 +149,446 @@ bool flash_erase(uint32_t addr, uint32_t length)
 
         if (!(sector_end_addr < addr || sector_start_addr >= addr + length))
         {
-            if (FLASH_COMPLETE != FLASH_EraseSector(sectors[i].sector_number, VoltageRange_3))
+            /* 128K 扇区擦除要 1~2s, 读一遍只要几百微秒 */
+            if (flash_is_blank(sector_start_addr, sectors[i].size))
+            {
+                if (report)
+                    report->skipped |= 1u << i;
+                continue;
+            }
+
+            if (FLASH_COMPLETE != FLASH_EraseSector(sectors[i].sector_number, FLASH_ERASE_RANGE))
             {
                 printf("erase sector %lu failed\r\n", sectors[i].sector_number);
                 flash_lock();
                 return false;
             }
+
+            if (report)
+                report->erased |= 1u << i;
         }
     }
     flash_lock();
     return true;
 }
 
-bool flash_write(uint32_t addr, const uint8_t *buf, uint32_t length)
+/* buf 可能不对齐, 逐字节拼成小端字; 必须内联, 不能在编程循环中调用 flash 里的函数 */
+#define FLASH_GET_WORD(p)   ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | \
+                             ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+/*
+ * PSIZE 和 PG 只设置一次, 之后连续写入。每次写入后等 BSY 清零并检查错误标志,
+ * 出错时停在出错的位置, 不依赖总线在编程期间暂停下一次写入。
+ */
+static FLASH_RAMFUNC uint32_t flash_program_x32(uint32_t addr, const uint8_t *buf, uint32_t words)
+{
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_WORD | FLASH_CR_PG;
+
+    for (uint32_t i = 0; i < words; i++, addr += 4, buf += 4)
+    {
+        *(volatile uint32_t *)addr = FLASH_GET_WORD(buf);
+        while (FLASH->SR & FLASH_SR_BSY);
+        if (FLASH->SR & FLASH_SR_ERRORS)
+            break;
+    }
+
+    FLASH->CR &= ~FLASH_CR_PG;
+
+    return FLASH->SR & FLASH_SR_ERRORS;
+}
+
+#if FLASH_PROGRAM_X64
+/* addr 必须 8 字节对齐 */
+static FLASH_RAMFUNC uint32_t flash_program_x64(uint32_t addr, const uint8_t *buf, uint32_t dwords)
 {
-    //进行4字节对齐
-    if (length % 4 !=0)
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_DOUBLE_WORD | FLASH_CR_PG;
+
+    for (uint32_t i = 0; i < dwords; i++, addr += 8, buf += 8)
     {
-        length = (length + 3) / 4 * 4;
+        *(volatile uint64_t *)addr = ((uint64_t)FLASH_GET_WORD(buf + 4) << 32) | FLASH_GET_WORD(buf);
+        while (FLASH->SR & FLASH_SR_BSY);
+        if (FLASH->SR & FLASH_SR_ERRORS)
+            break;
     }
 
+    FLASH->CR &= ~FLASH_CR_PG;
+
+    return FLASH->SR & FLASH_SR_ERRORS;
+}
+#endif
+
+/* addr 必须 4 字节对齐, 末尾不足一个字时补 0xFF (写 1 不改变已擦除的位) */
+bool flash_write(uint32_t addr, const uint8_t *buf, uint32_t length)
+{
+    uint32_t err = 0;
+
+    if (addr & 0x3)
+        return false;
 
+    flash_job_wait();
     flash_unlock();
+    FLASH_ClearFlag(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+                    FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+
+#if FLASH_PROGRAM_X64
+    /* 先用一个字对齐到 8 字节, 中间按双字编程 */
+    if ((addr & 0x7) && length >= 4)
+    {
+        err |= flash_program_x32(addr, buf, 1);
+        addr += 4; buf += 4; length -= 4;
+    }
+
+    uint32_t dwords = length / 8;
+    if (dwords > 0 && err == 0)
+    {
+        err |= flash_program_x64(addr, buf, dwords);
+        addr += dwords * 8; buf += dwords * 8; length -= dwords * 8;
+    }
+#endif
 
-    uint32_t cur_prgram_addr = addr;
-    for (uint16_t i = 0; i < length / 4; i++)
+    uint32_t words = length / 4;
+    if (words > 0 && err == 0)
     {
-        if (FLASH_COMPLETE != FLASH_ProgramWord(cur_prgram_addr, *(uint32_t *)(buf + i * 4)))
+        err |= flash_program_x32(addr, buf, words);
+        addr += words * 4; buf += words * 4; length -= words * 4;
+    }
+
+    if (length > 0 && err == 0)
+    {
+        uint8_t tail[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+        for (uint32_t i = 0; i < length; i++)
+            tail[i] = buf[i];
+        err |= flash_program_x32(addr, tail, 1);
+    }
+
+    flash_lock();
+
+    if (err)
+    {
+        printf("program failed near 0x%08lX, sr: 0x%02lX\r\n", addr, err);
+        return false;
+    }
+
+    return true;
+}
+
+
+/* addr 所在扇区号, 不在片内 flash 时返回 -1 */
+int flash_sector_index(uint32_t addr)
+{
+    for (uint16_t i = 0; i < ARRAY_SIZE(sectors); i++)
+    {
+        if (addr - sectors[i].start_address < sectors[i].size)
+            return i;
+    }
+    return -1;
+}
+
+bool flash_sector_info(int index, uint32_t *start, uint32_t *size)
+{
+    if (index < 0 || index >= (int)ARRAY_SIZE(sectors))
+        return false;
+
+    *start = sectors[index].start_address;
+    *size  = sectors[index].size;
+    return true;
+}
+
+/* 新旧内容逐字比较, 只编程不同的连续字段; 有位要 0->1 时返回 NEED_ERASE 并给出冲突地址 */
+flash_inplace_t flash_write_inplace(uint32_t addr, const uint8_t *buf, uint32_t length, uint32_t *conflict)
+{
+    const uint8_t *old = (const uint8_t *)addr;
+    uint32_t words = length / 4;
+    uint32_t i;
+
+    if (addr & 0x3)
+        return FLASH_INPLACE_FAIL;
+
+    /* 先整体检查, 冲突时不留下写了一半的帧 */
+    for (i = 0; i < words; i++)
+    {
+        uint32_t o = ((const uint32_t *)old)[i];
+        uint32_t n = FLASH_GET_WORD(buf + i * 4);
+        if ((o & n) != n)
+        {
+            if (conflict)
+                *conflict = addr + i * 4;
+            return FLASH_INPLACE_NEED_ERASE;
+        }
+    }
+    for (i = words * 4; i < length; i++)
+    {
+        if ((old[i] & buf[i]) != buf[i])
         {
-            printf("program word failed at 0X%04X\r\n", cur_prgram_addr);
-            flash_lock();
+            if (conflict)
+                *conflict = addr + i;
+            return FLASH_INPLACE_NEED_ERASE;
+        }
+    }
+
+    /* 末尾不足一字按整字比较, 补齐的 0xFF 不改变旧内容 */
+    i = 0;
+    while (i < length)
+    {
+        while (i < length && memcmp(old + i, buf + i, length - i < 4 ? length - i : 4) == 0)
+            i += 4;
+
+        uint32_t start = i;
+        while (i < length && memcmp(old + i, buf + i, length - i < 4 ? length - i : 4) != 0)
+            i += 4;
+
+        if (i > length)
+            i = length;
+        if (i > start && !flash_write(addr + start, buf + start, i - start))
+            return FLASH_INPLACE_FAIL;
+    }
+
+    return FLASH_INPLACE_OK;
+}
+
+/* 编程任务的下一个字, 末尾不足一个字时补 0xFF */
+static void flash_job_program_word(flash_job_t *job)
+{
+    uint32_t word;
+
+    if (job->remain >= 4)
+    {
+        word = FLASH_GET_WORD(job->data);
+        job->data   += 4;
+        job->remain -= 4;
+    }
+    else
+    {
+        uint8_t tail[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+        for (uint32_t i = 0; i < job->remain; i++)
+            tail[i] = job->data[i];
+        word = FLASH_GET_WORD(tail);
+        job->remain = 0;
+    }
+
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_WORD;
+    *(volatile uint32_t *)job->addr = word;
+    job->addr += 4;
+}
+
+/* 编程任务的下一次写入: x64 时地址 8 字节对齐且剩余够一个双字就按双字写, 否则写一个字 */
+static void flash_job_program_next(flash_job_t *job)
+{
+#if FLASH_PROGRAM_X64
+    if ((job->addr & 0x7) == 0 && job->remain >= 8)
+    {
+        uint64_t dword = ((uint64_t)FLASH_GET_WORD(job->data + 4) << 32) | FLASH_GET_WORD(job->data);
+
+        FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_DOUBLE_WORD;
+        *(volatile uint64_t *)job->addr = dword;
+        job->addr   += 8;
+        job->data   += 8;
+        job->remain -= 8;
+        return ;
+    }
+#endif
+    flash_job_program_word(job);
+}
+
+/* 写保护、编程序列等错误在写入时就置位, 操作不会开始, 也就没有 EOP, 必须当场检查 */
+static bool flash_job_started(flash_job_t *job)
+{
+    if (FLASH->SR & FLASH_SR_ERRORS)
+    {
+        job->status = FLASH_JOB_FAIL;
+        FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB);
+        return false;
+    }
+    return true;
+}
+
+/* 启动一个任务, 只写寄存器 (中断中调用); 不需要硬件操作 (空扇区, 空数据) 时直接完成并返回 false */
+static bool flash_job_launch(flash_job_t *job)
+{
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_SOP | FLASH_SR_ERRORS;
+
+    if (job->type == FLASH_JOB_ERASE)
+    {
+        if (job->status == FLASH_JOB_SKIPPED)
             return false;
+
+        FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SNB | FLASH_CR_PG)) | FLASH_ERASE_PSIZE |
+                    FLASH_CR_SER | sectors[job->sector].sector_number | FLASH_CR_IRQS;
+        FLASH->CR |= FLASH_CR_STRT;
+        return flash_job_started(job);
+    }
+
+    if (job->remain == 0)
+        return false;
+
+    FLASH->CR = (FLASH->CR & ~(FLASH_CR_SER | FLASH_CR_SNB)) | FLASH_CR_PG | FLASH_CR_IRQS;
+    flash_job_program_next(job);
+    return flash_job_started(job);
+}
+
+/*
+ * 从 job_run 起启动下一个需要硬件的任务; 遇到还没做空扇区检查的擦除任务时停下,
+ * 由主循环的 flash_job_resume 检查后接着启动。队列空或停下时关中断并上锁。调用时 FLASH 中断不能抢占
+ */
+static void flash_job_kick(void)
+{
+    while (job_run != job_tail)
+    {
+        flash_job_t *job = &jobs[job_run & FLASH_JOB_MASK];
+
+        if (job->type == FLASH_JOB_ERASE && !job->checked)
+            break;
+
+        if (flash_job_launch(job))
+        {
+            job_busy = true;
+            return ;
         }
+        job_run++;
     }
+
+    job_busy = false;
+    FLASH->CR &= ~(FLASH_CR_IRQS | FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB);
     flash_lock();
+}
+
+/*
+ * 主循环: 硬件空闲而队列中还有任务时接着启动。排在最前的擦除任务在这里做空扇区检查,
+ * 此时没有擦写在进行, 读 flash 不会被暂停; 整扇区读一遍要几百微秒, 不放在中断里做。
+ */
+static void flash_job_resume(void)
+{
+    NVIC_DisableIRQ(FLASH_IRQn);
+    if (!job_busy && job_run != job_tail)
+    {
+        flash_job_t *job = &jobs[job_run & FLASH_JOB_MASK];
+
+        if (job->type == FLASH_JOB_ERASE && !job->checked)
+        {
+            uint32_t start, size;
 
+            flash_sector_info(job->sector, &start, &size);
+            if (flash_is_blank(start, size))
+                job->status = FLASH_JOB_SKIPPED;
+            job->checked = true;
+        }
+
+        flash_unlock();
+        flash_job_kick();
+    }
+    NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+/* EOP 只在 EOPIE 置位时产生, 即只对队列中的任务; 编程任务每个字 (x64 时每个双字) 进一次中断 */
+void FLASH_IRQHandler(void)
+{
+    uint32_t sr = FLASH->SR;
+    FLASH->SR = FLASH_SR_EOP | FLASH_SR_SOP | FLASH_SR_ERRORS;
+
+    if (!job_busy)
+        return ;
+
+    flash_job_t *job = &jobs[job_run & FLASH_JOB_MASK];
+
+    if (sr & (FLASH_SR_SOP | FLASH_SR_ERRORS))
+        job->status = FLASH_JOB_FAIL;
+    else if (job->type == FLASH_JOB_PROGRAM && job->remain > 0)
+    {
+        flash_job_program_next(job);
+        if (flash_job_started(job))
+            return ;
+    }
+
+    FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB);
+    job_run++;
+    flash_job_kick();
+}
+
+void flash_job_init(void)
+{
+    NVIC_InitTypeDef NVIC_InitStructure;
+
+    job_head = job_run = job_tail = 0;
+    job_busy = false;
+
+    NVIC_InitStructure.NVIC_IRQChannel = FLASH_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 10;     // 低于串口, 不影响接收
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+}
+
+void flash_job_deinit(void)
+{
+    flash_job_wait();
+    NVIC_DisableIRQ(FLASH_IRQn);
+    NVIC_ClearPendingIRQ(FLASH_IRQn);
+}
+
+/* 任务先写入队列再推进 job_tail, 中断随时可能接着启动它; 硬件空闲时由 flash_job_resume 启动 */
+static bool flash_job_submit(const flash_job_t *job)
+{
+    if ((uint8_t)(job_tail - job_head) >= FLASH_JOB_QUEUE_DEPTH)
+        return false;
+
+    jobs[job_tail & FLASH_JOB_MASK] = *job;
+    job_tail++;
+    flash_job_resume();
     return true;
 }
 
+/* 擦除单个扇区, 已是全 0xFF 时跳过并以 FLASH_JOB_SKIPPED 回调; 空扇区检查在轮到该任务时于主循环中进行 */
+bool flash_job_erase(int sector, flash_job_cb_t cb, void *arg)
+{
+    flash_job_t job = {FLASH_JOB_ERASE, FLASH_JOB_DONE, sector, false, 0, NULL, 0, cb, arg};
+
+    if (sector < 0 || sector >= (int)ARRAY_SIZE(sectors))
+        return false;
+
+    return flash_job_submit(&job);
+}
+
+/* addr 必须 4 字节对齐; data 由调用者保管到回调为止 */
+bool flash_job_program(uint32_t addr, const uint8_t *data, uint32_t length, flash_job_cb_t cb, void *arg)
+{
+    flash_job_t job = {FLASH_JOB_PROGRAM, FLASH_JOB_DONE, -1, true, addr, data, length, cb, arg};
+
+    if (addr & 0x3)
+        return false;
+
+    return flash_job_submit(&job);
+}
+
+/* 还能提交的任务数, 为 0 时上层应暂缓处理新帧 */
+uint8_t flash_job_space(void)
+{
+    return FLASH_JOB_QUEUE_DEPTH - (uint8_t)(job_tail - job_head);
+}
+
+/* 在主循环中调用, 推进等待检查的擦除任务, 按提交顺序回调已完成的任务 */
+void flash_job_poll(void)
+{
+    flash_job_resume();
+
+    while (job_head != job_run)
+    {
+        flash_job_t job = jobs[job_head & FLASH_JOB_MASK];
+        job_head++;
+        if (job.cb)
+            job.cb(job.status, job.arg);
+    }
+}
+
+/* 等待队列中的任务全部执行完, 不回调; 同步擦写前调用 */
+void flash_job_wait(void)
+{
+    while (job_run != job_tail)
+        flash_job_resume();
+}
+
+/* 等待全部完成并回调 */
+void flash_job_flush(void)
+{
+    flash_job_wait();
+    flash_job_poll();
+}
@@ -4,9 +4,65 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * 擦写电压范围, 决定编程并行宽度:
+ *   3: 2.7V ~ 3.6V, x32
+ *   4: 2.7V ~ 3.6V 且 VPP 外接 8~9V, x64
+ */
+#ifndef FLASH_VOLTAGE_RANGE
+#define FLASH_VOLTAGE_RANGE     3
+#endif
+
+#define FLASH_SECTOR_NUM        12
+
+/* 按扇区号 (0~11) 置位的擦除结果 */
+typedef struct
+{
+    uint16_t erased;        // 实际擦除的扇区
+    uint16_t skipped;       // 已是全 0xFF, 跳过擦除的扇区
+} flash_erase_report_t;
+
+/* 原地写入: NOR 只能 1->0, 新数据是现有内容的位子集 ((old & new) == new) 时无需擦除 */
+typedef enum
+{
+    FLASH_INPLACE_OK,           // 已原地编程, 或内容本来就相同
+    FLASH_INPLACE_NEED_ERASE,   // 有位需要 0->1, 必须先擦除所在扇区, 此时一个字也没写
+    FLASH_INPLACE_FAIL          // 编程出错
+} flash_inplace_t;
+
+/*
+ * 异步任务队列: 擦除和编程任务按提交顺序由 FLASH EOP/ERR 中断推进,
+ * 完成回调在 flash_job_poll 的调用上下文 (主循环) 中执行。擦除任务的空扇区检查也在
+ * flash_job_poll 中, 轮到该任务时进行, 中断中只写寄存器。
+ * 同步的 flash_erase/flash_write 会先等队列清空。
+ */
+#define FLASH_JOB_QUEUE_DEPTH   8       // 2 的幂
+
+typedef enum
+{
+    FLASH_JOB_DONE,
+    FLASH_JOB_SKIPPED,          // 擦除: 扇区已是全 0xFF, 未擦除
+    FLASH_JOB_FAIL
+} flash_job_status_t;
+
+typedef void (*flash_job_cb_t)(flash_job_status_t status, void *arg);
+
 void flash_lock(void);
 void flash_unlock(void);
-bool flash_erase(uint32_t addr, uint32_t length);
+bool flash_is_blank(uint32_t addr, uint32_t length);
+bool flash_erase(uint32_t addr, uint32_t length, flash_erase_report_t *report);
 bool flash_write(uint32_t addr, const uint8_t *buf, uint32_t length);
+int flash_sector_index(uint32_t addr);
+bool flash_sector_info(int index, uint32_t *start, uint32_t *size);
+flash_inplace_t flash_write_inplace(uint32_t addr, const uint8_t *buf, uint32_t length, uint32_t *conflict);
+
+void flash_job_init(void);
+void flash_job_deinit(void);
+bool flash_job_erase(int sector, flash_job_cb_t cb, void *arg);
+bool flash_job_program(uint32_t addr, const uint8_t *data, uint32_t length, flash_job_cb_t cb, void *arg);
+uint8_t flash_job_space(void);
+void flash_job_poll(void);
+void flash_job_wait(void);
+void flash_job_flush(void);
 
 #endif /* __FLASH_OPS_H__ */
@@ -1,6 +1,14 @@
 #include "main.h"
 #include "stm32f4xx.h"
 #include "uart.h"
+#include "cpu_tick.h"
+
+#define UART_DEFAULT_BAUDRATE       115200
+#define UART_BAUD_MAX_ERR_PERMILLE  15      // 实际波特率允许的最大偏差 1.5%
+
+/* 0xAA 低位先发: start+b0 为 2 位低电平, 之后每位翻转, 到 b7 上升沿共 8 位 */
+#define UART_AUTOBAUD_EDGES         8
+#define UART_AUTOBAUD_BITS          8
 
 typedef struct uart_dev
 {
@@ -12,14 +20,62 @@ typedef struct uart_dev
     uint8_t  gpio_af_dev;
     GPIO_TypeDef *gpio_port;
     USART_TypeDef *dev_handle;
+    uint8_t  exti_port_source;      // 自动波特率: RX 引脚下降沿中断
+    uint32_t exti_line;
+    uint8_t  exti_irq;
 } uart_dev_t;
 
 static uart_dev_t uart_devs[] =
 {
-    {USART1_IRQn, GPIO_Pin_10, GPIO_Pin_9, GPIO_PinSource10, GPIO_PinSource9, GPIO_AF_USART1, GPIOA, USART1},
-    {USART2_IRQn, GPIO_Pin_3,  GPIO_Pin_2, GPIO_PinSource3,  GPIO_PinSource2, GPIO_AF_USART2, GPIOA, USART2},
+    {USART1_IRQn, GPIO_Pin_10, GPIO_Pin_9, GPIO_PinSource10, GPIO_PinSource9, GPIO_AF_USART1, GPIOA, USART1,
+     EXTI_PortSourceGPIOA, EXTI_Line10, EXTI15_10_IRQn},
+    {USART2_IRQn, GPIO_Pin_3,  GPIO_Pin_2, GPIO_PinSource3,  GPIO_PinSource2, GPIO_AF_USART2, GPIOA, USART2,
+     EXTI_PortSourceGPIOA, EXTI_Line3,  EXTI3_IRQn},
+};
+
+/* 自动波特率检测结果吸附到最近的标准波特率, 当前 (协商得到的) 波特率也作为候选 */
+static const uint32_t uart_std_baudrates[] =
+{
+    9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1000000, 1500000, 2000000
 };
 
+static uint32_t uart_baudrates[ARRAY_SIZE(uart_devs)];
+static volatile bool uart_autobaud_armed[ARRAY_SIZE(uart_devs)];
+
+static uint32_t uart_get_pclk(USART_TypeDef *usart)
+{
+    RCC_ClocksTypeDef clocks;
+
+    RCC_GetClocksFreq(&clocks);
+    /* USART1/USART6 挂在 APB2, 其余在 APB1 */
+    if (usart == USART1 || usart == USART6)
+        return clocks.PCLK2_Frequency;
+    return clocks.PCLK1_Frequency;
+}
+
+/* 计算 BRR, pclk/16 以上自动切换到 8 倍过采样; 偏差超限返回 0 */
+static uint16_t uart_calc_brr(uint32_t pclk, uint32_t baudrate, bool *over8)
+{
+    if (baudrate == 0)
+        return 0;
+
+    *over8 = baudrate > pclk / 16;
+
+    uint32_t div = (pclk + baudrate / 2) / baudrate;    // USARTDIV * 16 (或 * 8)
+    uint32_t min = *over8 ? 8 : 16;
+    if (div < min || div > 0xFFFF)
+        return 0;
+
+    uint32_t actual = pclk / div;
+    uint32_t err = actual > baudrate ? actual - baudrate : baudrate - actual;
+    if ((uint64_t)err * 1000 > (uint64_t)baudrate * UART_BAUD_MAX_ERR_PERMILLE)
+        return 0;
+
+    if (*over8)
+        return (uint16_t)(((div >> 3) << 4) | (div & 0x07));   // 8 倍过采样时 BRR[3] 必须为 0
+    return (uint16_t)div;
+}
+
 void uart_gpio_config(void)
 {
     GPIO_InitTypeDef GPIO_InitStructure;
@@ -47,7 +103,7 @@ void uart_lowlevel_init(void)
     for (int i = 0; i < ARRAY_SIZE(uart_devs); i++)
     {
         USART_StructInit(&USART_InitStructure);
-        USART_InitStructure.USART_BaudRate = 115200;
+        USART_InitStructure.USART_BaudRate = UART_DEFAULT_BAUDRATE;
         USART_InitStructure.USART_WordLength = USART_WordLength_8b;
         USART_InitStructure.USART_StopBits = USART_StopBits_1;
         USART_InitStructure.USART_Parity = USART_Parity_No;
@@ -56,9 +112,218 @@ void uart_lowlevel_init(void)
 
         USART_Init(uart_devs[i].dev_handle, &USART_InitStructure);
         USART_Cmd(uart_devs[i].dev_handle, ENABLE);
+
+        uart_baudrates[i] = UART_DEFAULT_BAUDRATE;
     }
 }
 
+bool uart_baudrate_check(uart_port_t port, uint32_t baudrate)
+{
+    bool over8;
+
+    return uart_calc_brr(uart_get_pclk(uart_devs[port].dev_handle), baudrate, &over8) != 0;
+}
+
+/* 只改 BRR/OVER8, 中断、DMA 使能等配置保持不变; 调用前应先等待发送完成 */
+bool uart_set_baudrate(uart_port_t port, uint32_t baudrate)
+{
+    USART_TypeDef *usart = uart_devs[port].dev_handle;
+    bool over8;
+    uint16_t brr = uart_calc_brr(uart_get_pclk(usart), baudrate, &over8);
+
+    if (brr == 0)
+        return false;
+
+    usart->CR1 &= ~USART_CR1_UE;
+    if (over8)
+        usart->CR1 |= USART_CR1_OVER8;
+    else
+        usart->CR1 &= ~USART_CR1_OVER8;
+    usart->BRR = brr;
+    usart->CR1 |= USART_CR1_UE;
+
+    uart_baudrates[port] = baudrate;
+    return true;
+}
+
+uint32_t uart_get_baudrate(uart_port_t port)
+{
+    return uart_baudrates[port];
+}
+
+static void uart_autobaud_exti(const uart_dev_t *dev, FunctionalState state)
+{
+    EXTI_InitTypeDef EXTI_InitStructure;
+
+    EXTI_InitStructure.EXTI_Line = dev->exti_line;
+    EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+    EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Falling;
+    EXTI_InitStructure.EXTI_LineCmd = state;
+    EXTI_Init(&EXTI_InitStructure);
+    EXTI_ClearITPendingBit(dev->exti_line);
+}
+
+/*
+ * 开始自动波特率检测: 关闭接收器, 在 RX 引脚的下降沿中断中测量 (见 uart_autobaud_edge), 不阻塞。
+ * 中断与 USART 同优先级, 检测成功后补交的帧头不会与接收中断交错; 测量时不关全局中断,
+ * 但同级和更低优先级的中断 (发送 DMA、FLASH) 要等测量结束, 因此每个边沿都有超时。
+ */
+void uart_autobaud_start(uart_port_t port)
+{
+    const uart_dev_t *dev = &uart_devs[port];
+    NVIC_InitTypeDef NVIC_InitStructure;
+
+    cpu_cycles_init();
+    dev->dev_handle->CR1 &= ~USART_CR1_RE;
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    SYSCFG_EXTILineConfig(dev->exti_port_source, dev->GPIO_PinSource_rx);
+    uart_autobaud_exti(dev, ENABLE);
+
+    NVIC_InitStructure.NVIC_IRQChannel = dev->exti_irq;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 5;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+    uart_autobaud_armed[port] = true;
+}
+
+/* 停止检测并打开接收器, 未在检测时也可调用 */
+void uart_autobaud_stop(uart_port_t port)
+{
+    const uart_dev_t *dev = &uart_devs[port];
+
+    uart_autobaud_exti(dev, DISABLE);
+    NVIC_DisableIRQ((IRQn_Type)dev->exti_irq);
+    NVIC_ClearPendingIRQ((IRQn_Type)dev->exti_irq);
+
+    uart_autobaud_armed[port] = false;
+    dev->dev_handle->CR1 |= USART_CR1_RE;
+}
+
+bool uart_autobaud_active(uart_port_t port)
+{
+    return uart_autobaud_armed[port];
+}
+
+/* 最慢的候选波特率, 决定第一段低电平最多等多久 */
+static uint32_t uart_autobaud_slowest(uart_port_t port)
+{
+    uint32_t slowest = uart_std_baudrates[0];
+
+    if (uart_baudrates[port] && uart_baudrates[port] < slowest)
+        slowest = uart_baudrates[port];
+    return slowest;
+}
+
+/* 测量值与候选相差 5% 以内时返回该候选, 否则返回 0 */
+static uint32_t uart_autobaud_match(uart_port_t port, uint32_t measured)
+{
+    for (uint32_t i = 0; i <= ARRAY_SIZE(uart_std_baudrates); i++)
+    {
+        uint32_t std = i < ARRAY_SIZE(uart_std_baudrates) ? uart_std_baudrates[i] : uart_baudrates[port];
+        uint32_t diff = measured > std ? measured - std : std - measured;
+        if (std && diff * 20 <= std)
+            return std;
+    }
+    return 0;
+}
+
+/*
+ * 波形不符时等到一段超过 1.5 位的高电平 (0xAA 中只有 b7 + 停止位, 或者线路空闲),
+ * 之后的下降沿就是起始位。否则主机连续发送 0xAA 时, 每次都会从字节中间的同一个边沿开始测量。
+ * 连续的 0xAA 每 10 位出现一次这样的高电平, 最多等 10 位。
+ */
+static void uart_autobaud_resync(const uart_dev_t *dev, uint32_t bit)
+{
+    uint32_t start = cpu_get_cycles();
+
+    while (cpu_get_cycles() - start < bit * 10)
+    {
+        if ((dev->gpio_port->IDR & dev->gpio_rx_pin) == 0)
+            continue;
+
+        uint32_t high = cpu_get_cycles();
+        while ((dev->gpio_port->IDR & dev->gpio_rx_pin) != 0)
+        {
+            if (cpu_get_cycles() - high > bit + bit / 2)
+                return ;
+        }
+    }
+}
+
+/*
+ * RX 下降沿中断中调用: 测量 0xAA 的位宽, 检测到后切换波特率、打开接收器并返回新波特率, 否则返回 0 继续等待。
+ * 最后一个边沿 (b7) 之后还有 b7+stop 两个位的时间重新打开接收器, 因此紧跟在 0xAA 后面的字节
+ * 可以按新波特率正常接收。位宽由 b0 之后的 6 位求出, 不计中断响应带来的起始沿延迟。
+ * 第一段 (2 位低电平) 最多等最慢候选的 2.5 位, 之后每段最多等第一段的 1.5 倍 (预期 1 位),
+ * 后 6 段合计不超过第一段的 4 倍, 干扰时很快放弃。加上重新同步, 最坏情况约为最慢候选的
+ * 22 位 (9600 时约 2.3 ms), 按 115200 以上通信时干扰引起的占用在几十微秒以内。
+ */
+uint32_t uart_autobaud_edge(uart_port_t port)
+{
+    const uart_dev_t *dev = &uart_devs[port];
+    uint32_t edges[UART_AUTOBAUD_EDGES];
+    uint32_t baudrate = 0;
+    uint32_t bit = 0;
+
+    edges[0] = cpu_get_cycles();
+    if (!uart_autobaud_armed[port])
+        goto out;
+
+    uint32_t timeout = SystemCoreClock / uart_autobaud_slowest(port) * 5 / 2;
+    uint32_t total = 0;
+    for (int i = 1; i < UART_AUTOBAUD_EDGES; i++)
+    {
+        uint32_t level = (i & 1) ? 0 : dev->gpio_rx_pin;    // 当前电平, 等待它翻转
+        while ((dev->gpio_port->IDR & dev->gpio_rx_pin) == level)
+        {
+            uint32_t now = cpu_get_cycles();
+            if (now - edges[i - 1] > timeout || (i > 1 && now - edges[1] > total))
+                goto out;
+        }
+        edges[i] = cpu_get_cycles();
+
+        if (i == 1)
+        {
+            timeout = (edges[1] - edges[0]) * 3 / 2;
+            total = (edges[1] - edges[0]) * 4;
+        }
+    }
+
+    bit = (edges[UART_AUTOBAUD_EDGES - 1] - edges[1]) / (UART_AUTOBAUD_BITS - 2);
+
+    /* 检查波形: 其余每段 1 位, 允许 25% 偏差; 第一段 2 位, 被中断响应缩短, 只要求在 1 ~ 2.5 位之间 */
+    uint32_t first = edges[1] - edges[0];
+    bool shape_ok = bit != 0 && first >= bit && first * 4 <= bit * 10;
+    for (int i = 2; shape_ok && i < UART_AUTOBAUD_EDGES; i++)
+    {
+        uint32_t width = edges[i] - edges[i - 1];
+        uint32_t diff = width > bit ? width - bit : bit - width;
+        if (diff * 4 > bit)
+            shape_ok = false;
+    }
+
+    if (shape_ok)
+    {
+        uint32_t std = uart_autobaud_match(port, SystemCoreClock / bit);
+        if (std && uart_set_baudrate(port, std))
+            baudrate = std;
+    }
+
+out:
+    if (baudrate == 0 && bit != 0)
+        uart_autobaud_resync(dev, bit);
+
+    /* 测量期间的边沿不再触发中断 */
+    EXTI_ClearITPendingBit(dev->exti_line);
+
+    if (baudrate)
+        uart_autobaud_stop(port);
+    return baudrate;
+}
+
 void uart_it_config(void)
 {
     NVIC_InitTypeDef NVIC_InitStructure;
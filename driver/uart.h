@@ -1,5 +1,23 @@
 #ifndef __UART_H__
 #define __UART_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 与 uart.c 中 uart_devs[] 的顺序一致 */
+typedef enum
+{
+    UART_PORT_BL,       // USART1, 升级通道
+    UART_PORT_DEBUG,    // USART2, printf 调试口
+    UART_PORT_NUM
+} uart_port_t;
+
+bool uart_baudrate_check(uart_port_t port, uint32_t baudrate);
+bool uart_set_baudrate(uart_port_t port, uint32_t baudrate);
+uint32_t uart_get_baudrate(uart_port_t port);
+void uart_autobaud_start(uart_port_t port);
+void uart_autobaud_stop(uart_port_t port);
+bool uart_autobaud_active(uart_port_t port);
+uint32_t uart_autobaud_edge(uart_port_t port);
 
 #endif /* __UART_H__*/
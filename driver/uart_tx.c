@@ -0,0 +1,327 @@
+#include <string.h>
+#include "main.h"
+#include "stm32f4xx.h"
+#include "uart_tx.h"
+
+#define UART_TX_QUEUE_MASK      (UART_TX_QUEUE_DEPTH - 1)
+
+typedef struct uart_tx_desc
+{
+    const uint8_t *data;
+    uint16_t length;
+    bool staged;                // 数据位于暂存 FIFO, 完成后释放
+    uart_tx_done_cb_t cb;
+    void *arg;
+} uart_tx_desc_t;
+
+typedef struct uart_tx_dev
+{
+    USART_TypeDef *usart;
+    DMA_Stream_TypeDef *stream;
+    uint32_t channel;
+    uint8_t NVIC_IRQChannel;
+    uint32_t it_tc;
+    uint32_t it_te;
+    uint8_t *fifo;
+    uint32_t fifo_size;
+} uart_tx_dev_t;
+
+typedef struct uart_tx_ctx
+{
+    volatile uint32_t fifo_head;    // 写入位置, 自由递增
+    volatile uint32_t fifo_tail;    // 释放位置, 自由递增
+    uart_tx_desc_t desc[UART_TX_QUEUE_DEPTH];
+    volatile uint8_t desc_head;     // 下一个空位
+    volatile uint8_t desc_tail;     // 正在发送/下一个待发送
+    volatile bool busy;
+} uart_tx_ctx_t;
+
+static uint8_t bl_fifo[UART_TX_BL_FIFO_SIZE];
+static uint8_t dbg_fifo[UART_TX_DBG_FIFO_SIZE];
+
+/* USART1_TX: DMA2 Stream7 Channel4, USART2_TX: DMA1 Stream6 Channel4 */
+static const uart_tx_dev_t uart_tx_devs[UART_PORT_NUM] =
+{
+    {USART1, DMA2_Stream7, DMA_Channel_4, DMA2_Stream7_IRQn, DMA_IT_TCIF7, DMA_IT_TEIF7, bl_fifo,  sizeof(bl_fifo)},
+    {USART2, DMA1_Stream6, DMA_Channel_4, DMA1_Stream6_IRQn, DMA_IT_TCIF6, DMA_IT_TEIF6, dbg_fifo, sizeof(dbg_fifo)},
+};
+
+static uart_tx_ctx_t uart_tx_ctxs[UART_PORT_NUM];
+static bool uart_tx_ready = false;
+
+static inline uint32_t uart_tx_enter_critical(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static inline void uart_tx_exit_critical(uint32_t primask)
+{
+    __set_PRIMASK(primask);
+}
+
+static inline uint8_t uart_tx_queued(const uart_tx_ctx_t *ctx)
+{
+    return (uint8_t)(ctx->desc_head - ctx->desc_tail);
+}
+
+/* 必须在临界区或 DMA 中断中调用 */
+static void uart_tx_kick(uart_port_t port)
+{
+    const uart_tx_dev_t *dev = &uart_tx_devs[port];
+    uart_tx_ctx_t *ctx = &uart_tx_ctxs[port];
+
+    if (ctx->busy || uart_tx_queued(ctx) == 0)
+        return ;
+
+    uart_tx_desc_t *desc = &ctx->desc[ctx->desc_tail & UART_TX_QUEUE_MASK];
+
+    DMA_Cmd(dev->stream, DISABLE);
+    while (DMA_GetCmdStatus(dev->stream) != DISABLE);
+    DMA_ClearITPendingBit(dev->stream, dev->it_tc);
+    DMA_ClearITPendingBit(dev->stream, dev->it_te);
+
+    DMA_MemoryTargetConfig(dev->stream, (uint32_t)desc->data, DMA_Memory_0);
+    DMA_SetCurrDataCounter(dev->stream, desc->length);
+
+    ctx->busy = true;
+    DMA_Cmd(dev->stream, ENABLE);
+}
+
+/* 处理一次传输完成: 释放描述符/FIFO, 启动下一段, 最后回调 */
+static void uart_tx_service(uart_port_t port)
+{
+    const uart_tx_dev_t *dev = &uart_tx_devs[port];
+    uart_tx_ctx_t *ctx = &uart_tx_ctxs[port];
+
+    if (DMA_GetITStatus(dev->stream, dev->it_tc) == RESET &&
+        DMA_GetITStatus(dev->stream, dev->it_te) == RESET)
+        return ;
+
+    DMA_ClearITPendingBit(dev->stream, dev->it_tc);
+    DMA_ClearITPendingBit(dev->stream, dev->it_te);
+
+    if (!ctx->busy)
+        return ;
+
+    uart_tx_desc_t *desc = &ctx->desc[ctx->desc_tail & UART_TX_QUEUE_MASK];
+    uart_tx_done_cb_t cb = desc->cb;
+    void *arg = desc->arg;
+
+    if (desc->staged)
+        ctx->fifo_tail += desc->length;
+
+    ctx->desc_tail++;
+    ctx->busy = false;
+    uart_tx_kick(port);
+
+    if (cb)
+        cb(arg);
+}
+
+/* 等待期间主动轮询完成标志, 关中断时调用也不会死锁 */
+static void uart_tx_wait(uart_port_t port)
+{
+    uint32_t primask = uart_tx_enter_critical();
+    uart_tx_service(port);
+    uart_tx_exit_critical(primask);
+}
+
+static void uart_tx_poll_send(uart_port_t port, const uint8_t *data, uint16_t length)
+{
+    USART_TypeDef *usart = uart_tx_devs[port].usart;
+
+    for (uint16_t i = 0; i < length; i++) {
+        while (USART_GetFlagStatus(usart, USART_FLAG_TXE) == RESET);
+        USART_SendData(usart, data[i]);
+    }
+}
+
+void uart_tx_init(void)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+    NVIC_InitTypeDef NVIC_InitStructure;
+
+    for (int i = 0; i < ARRAY_SIZE(uart_tx_devs); i++)
+    {
+        const uart_tx_dev_t *dev = &uart_tx_devs[i];
+
+        memset(&uart_tx_ctxs[i], 0, sizeof(uart_tx_ctxs[i]));
+
+        DMA_DeInit(dev->stream);
+        while (DMA_GetCmdStatus(dev->stream) != DISABLE);
+
+        DMA_StructInit(&DMA_InitStructure);
+        DMA_InitStructure.DMA_Channel = dev->channel;
+        DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&dev->usart->DR;
+        DMA_InitStructure.DMA_Memory0BaseAddr = (uint32_t)dev->fifo;
+        DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+        DMA_InitStructure.DMA_BufferSize = 1;
+        DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+        DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+        DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+        DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+        DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+        DMA_InitStructure.DMA_Priority = DMA_Priority_High;
+        DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
+        DMA_Init(dev->stream, &DMA_InitStructure);
+
+        DMA_ITConfig(dev->stream, DMA_IT_TC | DMA_IT_TE, ENABLE);
+
+        NVIC_InitStructure.NVIC_IRQChannel = dev->NVIC_IRQChannel;
+        NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 6;
+        NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+        NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+        NVIC_Init(&NVIC_InitStructure);
+
+        USART_DMACmd(dev->usart, USART_DMAReq_Tx, ENABLE);
+    }
+
+    uart_tx_ready = true;
+}
+
+void uart_tx_deinit(void)
+{
+    if (!uart_tx_ready)
+        return ;
+
+    for (int i = 0; i < ARRAY_SIZE(uart_tx_devs); i++)
+    {
+        const uart_tx_dev_t *dev = &uart_tx_devs[i];
+
+        uart_tx_flush((uart_port_t)i);
+
+        USART_DMACmd(dev->usart, USART_DMAReq_Tx, DISABLE);
+        DMA_Cmd(dev->stream, DISABLE);
+        DMA_DeInit(dev->stream);
+        NVIC_DisableIRQ((IRQn_Type)dev->NVIC_IRQChannel);
+        NVIC_ClearPendingIRQ((IRQn_Type)dev->NVIC_IRQChannel);
+    }
+
+    uart_tx_ready = false;
+}
+
+uint16_t uart_tx_write(uart_port_t port, const uint8_t *data, uint16_t length)
+{
+    const uart_tx_dev_t *dev = &uart_tx_devs[port];
+    uart_tx_ctx_t *ctx = &uart_tx_ctxs[port];
+    uint16_t written = 0;
+
+    if (!uart_tx_ready)
+    {
+        uart_tx_poll_send(port, data, length);
+        return length;
+    }
+
+    while (written < length)
+    {
+        /* 只有本函数推进 head, tail 只会被中断推大, 读到旧值也是保守的 */
+        uint32_t head  = ctx->fifo_head;
+        uint32_t free  = dev->fifo_size - (head - ctx->fifo_tail);
+        uint32_t contig = dev->fifo_size - (head & (dev->fifo_size - 1));
+        uint32_t n = length - written;
+
+        if (n > free)   n = free;
+        if (n > contig) n = contig;
+
+        if (n == 0 || uart_tx_queued(ctx) == UART_TX_QUEUE_DEPTH)
+        {
+            uart_tx_wait(port);
+            continue;
+        }
+
+        uint8_t *dst = &dev->fifo[head & (dev->fifo_size - 1)];
+        memcpy(dst, data + written, n);
+
+        uint32_t primask = uart_tx_enter_critical();
+
+        /* 尚未开始发送且地址连续的暂存段直接合并, printf 逐字符输出时不会产生大量描述符 */
+        uint8_t queued = uart_tx_queued(ctx);
+        uart_tx_desc_t *last = &ctx->desc[(uint8_t)(ctx->desc_head - 1) & UART_TX_QUEUE_MASK];
+
+        if (queued > (ctx->busy ? 1 : 0) && last->staged &&
+            last->data + last->length == dst && last->length + n <= 0xFFFF)
+        {
+            last->length += n;
+        }
+        else
+        {
+            uart_tx_desc_t *desc = &ctx->desc[ctx->desc_head & UART_TX_QUEUE_MASK];
+            desc->data   = dst;
+            desc->length = n;
+            desc->staged = true;
+            desc->cb     = NULL;
+            desc->arg    = NULL;
+            ctx->desc_head++;
+        }
+
+        ctx->fifo_head = head + n;
+        uart_tx_kick(port);
+        uart_tx_exit_critical(primask);
+
+        written += n;
+    }
+
+    return written;
+}
+
+bool uart_tx_submit(uart_port_t port, const uint8_t *data, uint16_t length,
+                    uart_tx_done_cb_t cb, void *arg)
+{
+    uart_tx_ctx_t *ctx = &uart_tx_ctxs[port];
+
+    if (!uart_tx_ready)
+        return false;
+
+    if (length == 0)
+    {
+        if (cb)
+            cb(arg);
+        return true;
+    }
+
+    while (uart_tx_queued(ctx) == UART_TX_QUEUE_DEPTH)
+        uart_tx_wait(port);
+
+    uint32_t primask = uart_tx_enter_critical();
+
+    uart_tx_desc_t *desc = &ctx->desc[ctx->desc_head & UART_TX_QUEUE_MASK];
+    desc->data   = data;
+    desc->length = length;
+    desc->staged = false;
+    desc->cb     = cb;
+    desc->arg    = arg;
+    ctx->desc_head++;
+
+    uart_tx_kick(port);
+    uart_tx_exit_critical(primask);
+
+    return true;
+}
+
+bool uart_tx_idle(uart_port_t port)
+{
+    uart_tx_ctx_t *ctx = &uart_tx_ctxs[port];
+
+    return !ctx->busy && uart_tx_queued(ctx) == 0;
+}
+
+void uart_tx_flush(uart_port_t port)
+{
+    while (uart_tx_ready && !uart_tx_idle(port))
+        uart_tx_wait(port);
+
+    /* 等最后一个字节移出移位寄存器 */
+    while (USART_GetFlagStatus(uart_tx_devs[port].usart, USART_FLAG_TC) == RESET);
+}
+
+void DMA2_Stream7_IRQHandler(void)
+{
+    uart_tx_service(UART_PORT_BL);
+}
+
+void DMA1_Stream6_IRQHandler(void)
+{
+    uart_tx_service(UART_PORT_DEBUG);
+}
@@ -0,0 +1,31 @@
+#ifndef __UART_TX_H__
+#define __UART_TX_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "uart.h"
+
+/* 每个端口可排队的发送描述符个数 */
+#define UART_TX_QUEUE_DEPTH     16
+
+/* 暂存 FIFO 大小, 必须是 2 的幂 */
+#define UART_TX_BL_FIFO_SIZE    1024
+#define UART_TX_DBG_FIFO_SIZE   2048
+
+/* 发送完成回调, 在 DMA 中断上下文中执行 */
+typedef void (*uart_tx_done_cb_t)(void *arg);
+
+void uart_tx_init(void);
+void uart_tx_deinit(void);
+
+/* 拷贝进暂存 FIFO 后立即返回, FIFO 满时等待 DMA 腾出空间 */
+uint16_t uart_tx_write(uart_port_t port, const uint8_t *data, uint16_t length);
+
+/* 零拷贝发送: data 在 cb 回调之前必须保持有效, 且不能位于 CCM RAM (DMA 无法访问) */
+bool uart_tx_submit(uart_port_t port, const uint8_t *data, uint16_t length,
+                    uart_tx_done_cb_t cb, void *arg);
+
+bool uart_tx_idle(uart_port_t port);
+void uart_tx_flush(uart_port_t port);
+
+#endif /* __UART_TX_H__ */
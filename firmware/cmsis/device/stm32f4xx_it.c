@@ -127,15 +127,7 @@ void PendSV_Handler(void)
 {
 }
 
-/**
-  * @brief  This function handles SysTick Handler.
-  * @param  None
-  * @retval None
-  */
-void SysTick_Handler(void)
-{
-  //TimingDelay_Decrement();
-}
+/* SysTick_Handler 由 driver/cpu_tick.c 提供 */
 
 /******************************************************************************/
 /*                 STM32F4xx Peripherals Interrupt Handlers                   */
@@ -0,0 +1,215 @@
+/*
+ * bl_lz 解码器主机校验和基准: 用简单的贪心编码器 (规则与 tools/bl_lz.py 相同) 压缩一份镜像,
+ * 按随机长度切分输入解码并与原文比对, 再按 DATA 帧大小连续喂入, 输出实测的解码速度。
+ * 镜像默认用合成数据 (重复的指令字、随机段和 0xFF 填充), 也可以给出真实的 app.bin。
+ *
+ *   make -C test lz_bench && ./test/lz_bench [total_bytes] [app.bin]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bl_lz.h"
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+#define IMAGE_SIZE          (256 * 1024)
+#define DATA_CHUNK          (4096 - 2)      // MTU 4096 的 DATA 帧去掉 seq
+#define HASH_BITS           12
+
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t length;
+    uint32_t limit;
+} sink_t;
+
+static uint32_t rand_next(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void put_len(uint8_t *out, uint32_t *o, uint32_t n)
+{
+    for (; n >= 255; n -= 255)
+        out[(*o)++] = 255;
+    out[(*o)++] = (uint8_t)n;
+}
+
+static void emit(uint8_t *out, uint32_t *o, const uint8_t *lit, uint32_t lit_len,
+                 uint32_t match_len, uint32_t offset)
+{
+    uint32_t token_lit = lit_len < 15 ? lit_len : 15;
+    uint32_t token_match = 0;
+
+    if (match_len)
+        token_match = match_len - BL_LZ_MIN_MATCH < 15 ? match_len - BL_LZ_MIN_MATCH : 15;
+    out[(*o)++] = (uint8_t)(token_lit << 4 | token_match);
+    if (lit_len >= 15)
+        put_len(out, o, lit_len - 15);
+    memcpy(&out[*o], lit, lit_len);
+    *o += lit_len;
+    if (match_len == 0)
+        return ;
+    out[(*o)++] = offset & 0xFF;
+    out[(*o)++] = offset >> 8;
+    if (match_len - BL_LZ_MIN_MATCH >= 15)
+        put_len(out, o, match_len - BL_LZ_MIN_MATCH - 15);
+}
+
+/* 贪心匹配, 每个 4 字节键只记最近一个位置; out 至少 n + n / 255 + 16 字节 */
+static uint32_t compress(const uint8_t *in, uint32_t n, uint8_t *out)
+{
+    static uint32_t head[1 << HASH_BITS];
+    uint32_t o = 0, pos = 0, anchor = 0;
+
+    memset(head, 0xFF, sizeof(head));
+    while (pos + BL_LZ_MIN_MATCH <= n)
+    {
+        uint32_t key;
+        memcpy(&key, &in[pos], 4);
+        key = (key * 2654435761u) >> (32 - HASH_BITS);
+
+        uint32_t cand = head[key];
+        head[key] = pos;
+
+        uint32_t len = 0;
+        if (cand != 0xFFFFFFFF && pos - cand <= BL_LZ_WINDOW_SIZE)
+            while (pos + len < n && in[cand + len] == in[pos + len])
+                len++;
+
+        if (len < BL_LZ_MIN_MATCH)
+        {
+            pos++;
+            continue;
+        }
+        emit(out, &o, &in[anchor], pos - anchor, len, pos - cand);
+        pos += len;
+        anchor = pos;
+    }
+    emit(out, &o, &in[anchor], n - anchor, 0, 0);
+    return o;
+}
+
+/* 类似固件的数据: 少量常用指令字反复出现, 夹杂随机常量, 末尾 0xFF 填充 */
+static void make_image(uint8_t *img, uint32_t n)
+{
+    uint32_t rnd = 0xC0FFEE;
+    uint32_t dict[64];
+    uint32_t pos = 0;
+
+    for (size_t i = 0; i < 64; i++)
+        dict[i] = rand_next(&rnd);
+
+    while (pos + 4 <= n - n / 8)
+    {
+        uint32_t r = rand_next(&rnd);
+        uint32_t w = (r & 0x3) ? dict[(r >> 2) % 64] : rand_next(&rnd);
+        memcpy(&img[pos], &w, 4);
+        pos += 4;
+    }
+    memset(&img[pos], 0xFF, n - pos);
+}
+
+static bool sink_flush(const uint8_t *data, uint32_t length, void *arg)
+{
+    sink_t *s = arg;
+
+    if (s->length + length > s->limit)
+        return false;
+    memcpy(&s->buf[s->length], data, length);
+    s->length += length;
+    return true;
+}
+
+/* 按随机长度切分输入解码, 覆盖 sequence 在任意位置被切开的情况 */
+static void verify(const uint8_t *img, uint32_t size, const uint8_t *lz, uint32_t lz_size, uint8_t *out)
+{
+    static uint8_t window[BL_LZ_WINDOW_SIZE];
+    uint32_t rnd = 0x12345678;
+
+    for (int round = 0; round < 8; round++)
+    {
+        sink_t s = { out, 0, size };
+        bl_lz_t dec;
+
+        bl_lz_init(&dec, window, size, sink_flush, &s);
+        for (uint32_t pos = 0; pos < lz_size; )
+        {
+            uint32_t n = round == 0 ? 1 : 1 + rand_next(&rnd) % DATA_CHUNK;
+            if (n > lz_size - pos)
+                n = lz_size - pos;
+            CHECK(bl_lz_feed(&dec, lz + pos, n));
+            pos += n;
+        }
+        CHECK(bl_lz_finish(&dec));
+        CHECK(s.length == size && memcmp(out, img, size) == 0);
+    }
+
+    /* 输出上限比镜像少 1 字节时必须报错 */
+    sink_t s = { out, 0, size };
+    bl_lz_t dec;
+    bl_lz_init(&dec, window, size - 1, sink_flush, &s);
+    CHECK(!bl_lz_feed(&dec, lz, lz_size) || !bl_lz_finish(&dec));
+}
+
+static uint32_t load_image(const char *path, uint8_t *img, uint32_t max)
+{
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    uint32_t n = (uint32_t)fread(img, 1, max, f);
+    fclose(f);
+    CHECK(n > 0);
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t img[1024 * 1024], out[1024 * 1024], lz[1024 * 1024 + 1024 * 1024 / 255 + 16];
+    static uint8_t window[BL_LZ_WINDOW_SIZE];
+    uint64_t total = argc > 1 ? strtoull(argv[1], NULL, 0) : 256u * 1024 * 1024;
+    uint32_t size;
+
+    if (argc > 2)
+        size = load_image(argv[2], img, sizeof(img));
+    else
+        make_image(img, size = IMAGE_SIZE);
+
+    uint32_t lz_size = compress(img, size, lz);
+    verify(img, size, lz, lz_size, out);
+    printf("image %u -> %u bytes (%.1f%%): decode check ok\n", size, lz_size, lz_size * 100.0 / size);
+
+    uint64_t rounds = total / size ? total / size : 1;
+    double t0 = now_sec();
+    for (uint64_t i = 0; i < rounds; i++)
+    {
+        sink_t s = { out, 0, size };
+        bl_lz_t dec;
+
+        bl_lz_init(&dec, window, size, sink_flush, &s);
+        for (uint32_t pos = 0; pos < lz_size; pos += DATA_CHUNK)
+            bl_lz_feed(&dec, lz + pos, lz_size - pos < DATA_CHUNK ? lz_size - pos : DATA_CHUNK);
+        bl_lz_finish(&dec);
+    }
+    double t = now_sec() - t0;
+
+    printf("bl_lz_feed: %8.1f MB/s in, %8.1f MB/s out\n",
+           rounds * lz_size / t / 1e6, rounds * size / t / 1e6);
+    return 0;
+}
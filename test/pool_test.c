@@ -0,0 +1,171 @@
+/*
+ * bl_pool 主机测试: 块的地址和对齐、分配顺序、耗尽返回 NULL、used/high_water 计数,
+ * 写满一块不破坏其他块, 随机分配/释放与模型比对, 以及临界区退出后 PRIMASK 恢复原值。
+ * 硬件相关的 stm32f4xx.h 由 test/stub 中的替身代替。
+ *
+ *   make -C test pool_test && ./test/pool_test
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bl_pool.h"
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+#define SLOT_SIZE       13      // 取整到 16
+#define SLOT_NUM        8
+#define CHURN_ROUNDS    1000000
+
+uint32_t stub_primask = 0;
+uint32_t stub_irq_disables = 0;
+
+static uint32_t storage[BL_POOL_STORAGE_WORDS(SLOT_SIZE, SLOT_NUM)];
+
+static uint32_t rand_next(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int slot_index(const bl_pool_t *pool, const void *slot)
+{
+    ptrdiff_t off = (const uint8_t *)slot - pool->base;
+
+    CHECK(off >= 0 && (uint32_t)off % pool->slot_size == 0);
+    CHECK((uint32_t)off / pool->slot_size < pool->slot_num);
+    return (int)((uint32_t)off / pool->slot_size);
+}
+
+static void test_basic(void)
+{
+    bl_pool_t pool;
+    uint8_t *slots[SLOT_NUM];
+
+    bl_pool_init(&pool, storage, SLOT_SIZE, SLOT_NUM);
+    CHECK(pool.slot_size == BL_POOL_SLOT_ALIGN(SLOT_SIZE) && pool.slot_size == 16);
+    CHECK(bl_pool_used(&pool) == 0 && bl_pool_high_water(&pool) == 0);
+
+    /* 按地址顺序分配, 每块字对齐且在 storage 内 */
+    for (int i = 0; i < SLOT_NUM; i++)
+    {
+        slots[i] = bl_pool_alloc(&pool);
+        CHECK(slots[i] != NULL);
+        CHECK(slot_index(&pool, slots[i]) == i);
+        CHECK(((uintptr_t)slots[i] & 0x3) == 0);
+        CHECK(bl_pool_used(&pool) == i + 1 && bl_pool_high_water(&pool) == i + 1);
+    }
+    CHECK(bl_pool_alloc(&pool) == NULL);
+    CHECK(bl_pool_used(&pool) == SLOT_NUM);
+
+    /* 写满每块 (含取整前的全部字节), 互不覆盖 */
+    for (int i = 0; i < SLOT_NUM; i++)
+        memset(slots[i], 0xA0 + i, SLOT_SIZE);
+    for (int i = 0; i < SLOT_NUM; i++)
+        for (int k = 0; k < SLOT_SIZE; k++)
+            CHECK(slots[i][k] == 0xA0 + i);
+
+    /* 释放后后进先出, high_water 保持最大值 */
+    bl_pool_free(&pool, slots[3]);
+    bl_pool_free(&pool, slots[5]);
+    CHECK(bl_pool_used(&pool) == SLOT_NUM - 2 && bl_pool_high_water(&pool) == SLOT_NUM);
+    CHECK(bl_pool_alloc(&pool) == slots[5]);
+    CHECK(bl_pool_alloc(&pool) == slots[3]);
+    CHECK(bl_pool_alloc(&pool) == NULL);
+
+    /* 释放 NULL 不改变计数 */
+    bl_pool_free(&pool, NULL);
+    CHECK(bl_pool_used(&pool) == SLOT_NUM);
+
+    for (int i = 0; i < SLOT_NUM; i++)
+        bl_pool_free(&pool, slots[i]);
+    CHECK(bl_pool_used(&pool) == 0 && bl_pool_high_water(&pool) == SLOT_NUM);
+
+    /* 重新 init 清零 high_water */
+    bl_pool_init(&pool, storage, SLOT_SIZE, SLOT_NUM);
+    CHECK(bl_pool_used(&pool) == 0 && bl_pool_high_water(&pool) == 0);
+}
+
+/* 随机分配/释放, 与记录已分配块的模型比对 */
+static void test_churn(void)
+{
+    bl_pool_t pool;
+    uint8_t *held[SLOT_NUM];
+    int held_num = 0;
+    int peak = 0;
+    uint32_t rnd = 0xC0FFEE;
+
+    bl_pool_init(&pool, storage, SLOT_SIZE, SLOT_NUM);
+    for (int round = 0; round < CHURN_ROUNDS; round++)
+    {
+        uint32_t r = rand_next(&rnd);
+
+        if (r & 1)
+        {
+            uint8_t *slot = bl_pool_alloc(&pool);
+            if (held_num == SLOT_NUM)
+            {
+                CHECK(slot == NULL);
+                continue;
+            }
+            CHECK(slot != NULL);
+            int idx = slot_index(&pool, slot);
+            for (int i = 0; i < held_num; i++)
+                CHECK(held[i] != slot);
+            memset(slot, idx, pool.slot_size);
+            held[held_num++] = slot;
+            if (held_num > peak)
+                peak = held_num;
+        }
+        else if (held_num > 0)
+        {
+            int i = (r >> 1) % held_num;
+            uint8_t *slot = held[i];
+            int idx = slot_index(&pool, slot);
+            for (uint32_t k = 0; k < pool.slot_size; k++)
+                CHECK(slot[k] == idx);
+            bl_pool_free(&pool, slot);
+            held[i] = held[--held_num];
+        }
+
+        CHECK(bl_pool_used(&pool) == held_num);
+        CHECK(bl_pool_high_water(&pool) == peak);
+    }
+}
+
+/* 临界区退出后恢复进入前的 PRIMASK, 在已关中断的上下文里调用时不会把中断打开 */
+static void test_critical(void)
+{
+    bl_pool_t pool;
+
+    bl_pool_init(&pool, storage, SLOT_SIZE, SLOT_NUM);
+    for (uint32_t primask = 0; primask <= 1; primask++)
+    {
+        uint32_t disables = stub_irq_disables;
+
+        stub_primask = primask;
+        void *slot = bl_pool_alloc(&pool);
+        CHECK(stub_primask == primask);
+        bl_pool_free(&pool, slot);
+        CHECK(stub_primask == primask);
+        CHECK(stub_irq_disables == disables + 2);
+    }
+    stub_primask = 0;
+}
+
+int main(void)
+{
+    test_basic();
+    test_churn();
+    test_critical();
+    printf("bl_pool: all checks ok\n");
+    return 0;
+}
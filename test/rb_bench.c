@@ -0,0 +1,169 @@
+/*
+ * ringbuffer 主机吞吐基准: 生产者/消费者两个线程, 按不同的块长和接口搬运固定字节数,
+ * 输出 MB/s。只用于比较接口和块长的相对开销, 绝对值与 MCU 上的结果无关。
+ *
+ *   make -C test rb_bench && ./test/rb_bench [total_bytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ringbuffer.h"
+
+#define BENCH_RING_SIZE     4096        // 与接收环同级别
+
+typedef enum
+{
+    BENCH_BYTE,         // rb_write / rb_read
+    BENCH_BLOCK,        // rb_write_block / rb_read_block
+    BENCH_SPAN          // rb_write_span / rb_peek_span + commit
+} bench_mode_t;
+
+typedef struct
+{
+    rb_t rb;
+    bench_mode_t mode;
+    uint32_t chunk;
+    uint64_t total;
+    uint32_t sum;       // 消费者累加, 防止读被优化掉
+} bench_arg_t;
+
+static const char *mode_name[] = {"byte", "block", "span"};
+
+static void *producer(void *p)
+{
+    bench_arg_t *arg = (bench_arg_t *)p;
+    static uint8_t src[BENCH_RING_SIZE];
+    uint64_t pos = 0;
+
+    memset(src, 0x5A, sizeof(src));
+    while (pos < arg->total)
+    {
+        uint32_t len = arg->chunk;
+        uint32_t n = 0;
+
+        if (len > arg->total - pos)
+            len = (uint32_t)(arg->total - pos);
+
+        switch (arg->mode)
+        {
+            case BENCH_BYTE:
+                while (n < len && rb_write(arg->rb, (uint8_t)n))
+                    n++;
+                break;
+            case BENCH_BLOCK:
+                n = rb_write_block(arg->rb, src, len);
+                break;
+            default:
+            {
+                uint8_t *span;
+                n = rb_write_span(arg->rb, &span);
+                if (n > len)
+                    n = len;
+                memcpy(span, src, n);
+                rb_commit_write(arg->rb, n);
+                break;
+            }
+        }
+
+        pos += n;
+        if (n == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *consumer(void *p)
+{
+    bench_arg_t *arg = (bench_arg_t *)p;
+    static uint8_t dst[BENCH_RING_SIZE];
+    uint64_t pos = 0;
+    uint32_t sum = 0;
+
+    while (pos < arg->total)
+    {
+        uint32_t n = 0;
+
+        switch (arg->mode)
+        {
+            case BENCH_BYTE:
+            {
+                uint8_t c;
+                while (n < arg->chunk && rb_read(arg->rb, &c))
+                {
+                    sum += c;
+                    n++;
+                }
+                break;
+            }
+            case BENCH_BLOCK:
+                n = rb_read_block(arg->rb, dst, arg->chunk);
+                sum += dst[0];
+                break;
+            default:
+            {
+                const uint8_t *span;
+                n = rb_peek_span(arg->rb, 0, &span);
+                if (n > arg->chunk)
+                    n = arg->chunk;
+                if (n)
+                    sum += span[n - 1];
+                rb_commit_read(arg->rb, n);
+                break;
+            }
+        }
+
+        pos += n;
+        if (n == 0)
+            sched_yield();
+    }
+
+    arg->sum = sum;
+    return NULL;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench(bench_mode_t mode, uint32_t chunk, uint64_t total)
+{
+    static uint32_t storage[RB_STORAGE_SIZE(BENCH_RING_SIZE) / 4];
+    bench_arg_t arg;
+    pthread_t tp, tc;
+
+    arg.rb = rb_init((uint8_t *)storage, sizeof(storage));
+    arg.mode = mode;
+    arg.chunk = chunk;
+    arg.total = total;
+
+    double t0 = now_sec();
+    pthread_create(&tc, NULL, consumer, &arg);
+    pthread_create(&tp, NULL, producer, &arg);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+    double t = now_sec() - t0;
+
+    printf("%-6s chunk %5u: %9.1f MB/s  (sum %08x)\n",
+           mode_name[mode], chunk, total / t / 1e6, arg.sum);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t total = argc > 1 ? strtoull(argv[1], NULL, 0) : 64u * 1024 * 1024;
+    static const uint32_t chunks[] = {16, 64, 256, 1024};
+
+    printf("ring %u bytes, %llu bytes per run\n", BENCH_RING_SIZE, (unsigned long long)total);
+
+    bench(BENCH_BYTE, 256, total / 8);
+    for (unsigned i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+        bench(BENCH_BLOCK, chunks[i], total);
+    for (unsigned i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+        bench(BENCH_SPAN, chunks[i], total);
+    return 0;
+}
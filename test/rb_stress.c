@@ -0,0 +1,264 @@
+/*
+ * ringbuffer 主机压力测试: 一个生产者线程 + 一个消费者线程 (SPSC), 两侧轮换使用
+ * 单字节、块、span 三组接口, 消费者逐字节比对序列。另有单线程的回绕/边界检查。
+ *
+ *   make -C test rb_stress && ./test/rb_stress [total_bytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ringbuffer.h"
+
+#define CHECK(cond)                                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+/* 第 i 个字节的内容, 周期远大于环的容量, 错位/重复/丢字节都会被发现 */
+static uint8_t seq_byte(uint64_t i)
+{
+    return (uint8_t)((i * 131u) ^ (i >> 8) ^ (i >> 17));
+}
+
+/* 各线程自己的伪随机数, 决定本轮用哪组接口和多长 */
+static uint32_t rand_next(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+typedef struct
+{
+    rb_t rb;
+    uint64_t total;
+    uint32_t seed;
+} stress_arg_t;
+
+static void *producer(void *p)
+{
+    stress_arg_t *arg = (stress_arg_t *)p;
+    uint32_t rnd = arg->seed;
+    uint64_t pos = 0;
+    uint8_t tmp[512];
+
+    while (pos < arg->total)
+    {
+        uint32_t r = rand_next(&rnd);
+        uint32_t len = 1 + (r >> 8) % sizeof(tmp);
+        uint32_t n = 0;
+
+        if (len > arg->total - pos)
+            len = (uint32_t)(arg->total - pos);
+
+        switch (r % 3)
+        {
+            case 0:     // 单字节
+            {
+                while (n < len && rb_write(arg->rb, seq_byte(pos + n)))
+                    n++;
+                break;
+            }
+            case 1:     // 块
+            {
+                for (uint32_t i = 0; i < len; i++)
+                    tmp[i] = seq_byte(pos + i);
+                n = rb_write_block(arg->rb, tmp, len);
+                break;
+            }
+            default:    // span, 只填一部分再发布
+            {
+                uint8_t *span;
+                n = rb_write_span(arg->rb, &span);
+                if (n > len)
+                    n = len;
+                for (uint32_t i = 0; i < n; i++)
+                    span[i] = seq_byte(pos + i);
+                rb_commit_write(arg->rb, n);
+                break;
+            }
+        }
+
+        pos += n;
+        if (n == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void *consumer(void *p)
+{
+    stress_arg_t *arg = (stress_arg_t *)p;
+    uint32_t rnd = arg->seed * 7 + 1;
+    uint64_t pos = 0;
+    uint8_t tmp[512];
+
+    while (pos < arg->total)
+    {
+        uint32_t r = rand_next(&rnd);
+        uint32_t len = 1 + (r >> 8) % sizeof(tmp);
+        uint32_t n = 0;
+
+        switch (r % 4)
+        {
+            case 0:     // 单字节
+            {
+                uint8_t c;
+                while (n < len && rb_read(arg->rb, &c))
+                {
+                    CHECK(c == seq_byte(pos + n));
+                    n++;
+                }
+                break;
+            }
+            case 1:     // 块
+            {
+                n = rb_read_block(arg->rb, tmp, len);
+                for (uint32_t i = 0; i < n; i++)
+                    CHECK(tmp[i] == seq_byte(pos + i));
+                break;
+            }
+            case 2:     // 带偏移的 peek, 再整体释放
+            {
+                uint32_t off = r & 0x7;
+                uint32_t m = rb_peek(arg->rb, off, tmp, len);
+                for (uint32_t i = 0; i < m; i++)
+                    CHECK(tmp[i] == seq_byte(pos + off + i));
+                if (m)
+                {
+                    CHECK(rb_peek(arg->rb, 0, tmp, off) == off);
+                    for (uint32_t i = 0; i < off; i++)
+                        CHECK(tmp[i] == seq_byte(pos + i));
+                }
+                n = m ? off + m : 0;
+                if (n)
+                    rb_commit_read(arg->rb, n);
+                break;
+            }
+            default:    // 逐段 peek_span, 最多两段
+            {
+                const uint8_t *span;
+                uint32_t m;
+                while (n < len && (m = rb_peek_span(arg->rb, n, &span)) != 0)
+                {
+                    if (m > len - n)
+                        m = len - n;
+                    for (uint32_t i = 0; i < m; i++)
+                        CHECK(span[i] == seq_byte(pos + n + i));
+                    n += m;
+                }
+                rb_commit_read(arg->rb, n);
+                break;
+            }
+        }
+
+        pos += n;
+        if (n == 0)
+            sched_yield();
+    }
+
+    CHECK(rb_is_empty(arg->rb));
+    return NULL;
+}
+
+static void stress(uint32_t data_size, uint64_t total)
+{
+    uint8_t *storage = malloc(RB_STORAGE_SIZE(data_size));
+    stress_arg_t arg;
+    pthread_t tp, tc;
+
+    CHECK(storage != NULL);
+    arg.rb = rb_init(storage, RB_STORAGE_SIZE(data_size));
+    arg.total = total;
+    arg.seed = 0x9E3779B9u ^ data_size;
+    CHECK(arg.rb != NULL && rb_capacity(arg.rb) == data_size);
+
+    CHECK(pthread_create(&tc, NULL, consumer, &arg) == 0);
+    CHECK(pthread_create(&tp, NULL, producer, &arg) == 0);
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+
+    printf("spsc %6u bytes ring: %llu bytes ok\n", data_size, (unsigned long long)total);
+    free(storage);
+}
+
+/* 单线程: 容量取整、满/空、跨环尾的 span 和 peek */
+static void basic(void)
+{
+    uint32_t words[(RB_STORAGE_SIZE(16) + 8) / 4];     // 数据区 24 字节, 向下取整为 16
+    uint8_t *storage = (uint8_t *)words;
+    uint8_t buf[32];
+    const uint8_t *span;
+    uint8_t *wspan;
+
+    CHECK(rb_init(storage, RB_HEADER_SIZE) == NULL);
+
+    rb_t rb = rb_init(storage, sizeof(words));
+    CHECK(rb_capacity(rb) == 16);
+    CHECK(rb_is_empty(rb) && rb_space(rb) == 16);
+
+    /* 写满后再写失败 */
+    for (int i = 0; i < 16; i++)
+        CHECK(rb_write(rb, (uint8_t)i));
+    CHECK(rb_is_full(rb) && !rb_write(rb, 0xFF));
+    CHECK(rb_write_block(rb, buf, 4) == 0);
+    CHECK(rb_write_span(rb, &wspan) == 0);
+
+    /* 读走 12 字节, 读索引停在 12, 之后的写入跨环尾 */
+    CHECK(rb_read_block(rb, buf, 12) == 12);
+    for (int i = 0; i < 12; i++)
+        CHECK(buf[i] == i);
+
+    for (int i = 0; i < 10; i++)
+        buf[i] = (uint8_t)(16 + i);
+    CHECK(rb_write_block(rb, buf, 10) == 10);
+    CHECK(rb_count(rb) == 14);
+
+    /* 可读数据 12..25 分成环尾 4 字节和环头 10 字节两段 */
+    CHECK(rb_peek_span(rb, 0, &span) == 4 && span[0] == 12);
+    CHECK(rb_peek_span(rb, 4, &span) == 10 && span[0] == 16);
+    CHECK(rb_peek_span(rb, 14, &span) == 0 && span == NULL);
+
+    memset(buf, 0, sizeof(buf));
+    CHECK(rb_peek(rb, 2, buf, sizeof(buf)) == 12);
+    for (int i = 0; i < 12; i++)
+        CHECK(buf[i] == 14 + i);
+    CHECK(rb_count(rb) == 14);
+
+    /* 可写段只到读索引之前 */
+    CHECK(rb_write_span(rb, &wspan) == 2);
+    wspan[0] = 26;
+    wspan[1] = 27;
+    rb_commit_write(rb, 2);
+    CHECK(rb_is_full(rb));
+
+    rb_commit_read(rb, 14);
+    uint8_t c;
+    CHECK(rb_read(rb, &c) && c == 26);
+    CHECK(rb_read(rb, &c) && c == 27);
+    CHECK(!rb_read(rb, &c) && rb_is_empty(rb));
+
+    printf("basic ok\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t total = argc > 1 ? strtoull(argv[1], NULL, 0) : 16u * 1024 * 1024;
+
+    basic();
+
+    /* 小环频繁回绕, 大环接近实际的接收环 */
+    stress(16, total / 4);
+    stress(64, total / 2);
+    stress(4096, total);
+    stress(16384, total);
+
+    printf("all ok\n");
+    return 0;
+}
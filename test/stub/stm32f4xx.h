@@ -0,0 +1,34 @@
+#ifndef __TEST_STUB_STM32F4XX_H
+#define __TEST_STUB_STM32F4XX_H
+
+/*
+ * 主机测试用的替身: 只提供 app 中与硬件无关模块用到的 CMSIS 内核函数。
+ * PRIMASK 用一个变量模拟, 测试可以检查临界区退出后是否恢复原值。
+ */
+#include <stdint.h>
+
+extern uint32_t stub_primask;
+extern uint32_t stub_irq_disables;
+
+static inline uint32_t __get_PRIMASK(void)
+{
+    return stub_primask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+    stub_primask = primask;
+}
+
+static inline void __disable_irq(void)
+{
+    stub_primask = 1;
+    stub_irq_disables++;
+}
+
+static inline void __enable_irq(void)
+{
+    stub_primask = 0;
+}
+
+#endif /* __TEST_STUB_STM32F4XX_H */
@@ -1,4 +1,5 @@
 #include "crc16.h"
+#include "crc_config.h"
 
 /*
  * The crc32 is licensed under the Apache License, Version 2.0, and a copy of the license is included in this file.
@@ -51,10 +52,63 @@ static const uint16_t crc16tab[256]= {
     0x6e17,0x7e36,0x4e55,0x5e74,0x2e93,0x3eb2,0x0ed1,0x1ef0
 };
 
+#if CRC16_SLICE_BY > 1
+/* crc16_slice[k][n]: 字节 n 后面再跟 k + 1 个 0 字节的 CRC, crc16tab 即第 0 张表 */
+static uint16_t crc16_slice[CRC16_SLICE_BY - 1][256] CRC_TABLE_ATTR;
+#endif
+
+void crc16_tables_init(void) {
+#if CRC16_SLICE_BY > 1
+    for (size_t n = 0; n < 256; n++) {
+        uint16_t c = crc16tab[n];
+        for (size_t k = 0; k < CRC16_SLICE_BY - 1; k++) {
+            c = (uint16_t)(c << 8) ^ crc16tab[c >> 8];
+            crc16_slice[k][n] = c;
+        }
+    }
+#endif
+}
+
+void crc16_init(crc16_ctx_t *ctx) {
+    ctx->crc = 0;
+}
+
+void crc16_update(crc16_ctx_t *ctx, const unsigned char *buf, size_t len) {
+    uint16_t crc = ctx->crc;
+
+#if CRC16_SLICE_BY > 1
+    /* 逐字节处理到 4 字节对齐, 之后按小端字读取; 当前 CRC 与最先到达的两个字节异或 */
+    for (; len > 0 && ((uintptr_t)buf & 0x3); len--)
+        crc = (crc<<8) ^ crc16tab[((crc>>8) ^ *buf++)&0x00FF];
+
+    for (; len >= CRC16_SLICE_BY; len -= CRC16_SLICE_BY, buf += CRC16_SLICE_BY) {
+        const uint32_t *w = (const uint32_t *)buf;
+        uint32_t one = w[0];
+#if CRC16_SLICE_BY == 8
+        uint32_t two = w[1];
+        crc = crc16_slice[6][(one & 0xFF) ^ (crc >> 8)]          ^ crc16_slice[5][((one >> 8) & 0xFF) ^ (crc & 0xFF)] ^
+              crc16_slice[4][(one >> 16) & 0xFF]                 ^ crc16_slice[3][one >> 24]                          ^
+              crc16_slice[2][two & 0xFF]                         ^ crc16_slice[1][(two >> 8) & 0xFF]                  ^
+              crc16_slice[0][(two >> 16) & 0xFF]                 ^ crc16tab[two >> 24];
+#else
+        crc = crc16_slice[2][(one & 0xFF) ^ (crc >> 8)]          ^ crc16_slice[1][((one >> 8) & 0xFF) ^ (crc & 0xFF)] ^
+              crc16_slice[0][(one >> 16) & 0xFF]                 ^ crc16tab[one >> 24];
+#endif
+    }
+#endif
+
+    for (; len > 0; len--)
+        crc = (crc<<8) ^ crc16tab[((crc>>8) ^ *buf++)&0x00FF];
+    ctx->crc = crc;
+}
+
+uint16_t crc16_final(const crc16_ctx_t *ctx) {
+    return ctx->crc;
+}
+
 uint16_t crc16(const unsigned char *buf, size_t len) {
-    int counter;
-    uint16_t crc = 0;
-    for (counter = 0; counter < len; counter++)
-            crc = (crc<<8) ^ crc16tab[((crc>>8) ^ *buf++)&0x00FF];
-    return crc;
+    crc16_ctx_t ctx;
+    crc16_init(&ctx);
+    crc16_update(&ctx, buf, len);
+    return crc16_final(&ctx);
 }
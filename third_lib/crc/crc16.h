@@ -8,6 +8,18 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+/* 流式计算: init -> update (可多次) -> final, 结果与一次性 crc16() 相同 */
+typedef struct {
+    uint16_t crc;
+} crc16_ctx_t;
+
+/* 推导 slicing 用的 RAM 表, 须在第一次计算前调用一次 */
+void crc16_tables_init(void);
+
+void crc16_init(crc16_ctx_t *ctx);
+void crc16_update(crc16_ctx_t *ctx, const unsigned char *buf, size_t len);
+uint16_t crc16_final(const crc16_ctx_t *ctx);
+
 uint16_t crc16(const unsigned char *buf, size_t len);
 
 #ifdef __cplusplus
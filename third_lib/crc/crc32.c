@@ -12,7 +12,9 @@
 */
 #include <stdlib.h>
 #include "crc32.h"
-static uint32_t crc32_tab[] =
+#include "crc_config.h"
+
+static const uint32_t crc32_tab[] =
 {
     0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
     0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
@@ -68,16 +70,74 @@ static uint32_t crc32_tab[] =
     0x2d02ef8dL
 };
 
-/* crc32 hash */
-uint32_t crc32(const unsigned char *s, size_t len)
+#if CRC32_SLICE_BY > 1
+/* crc32_slice[k][n]: 字节 n 后面再跟 k + 1 个 0 字节的 CRC, crc32_tab 即第 0 张表 */
+static uint32_t crc32_slice[CRC32_SLICE_BY - 1][256] CRC_TABLE_ATTR;
+#endif
+
+void crc32_tables_init(void)
 {
-    int i;
-    uint32_t crc32val = 0;
-    crc32val ^= 0xFFFFFFFF;
+#if CRC32_SLICE_BY > 1
+    for (size_t n = 0; n < 256; n++)
+    {
+        uint32_t c = crc32_tab[n];
 
-    for (i = 0;  i < len;  i++) {
-        crc32val = crc32_tab[(crc32val ^ s[i]) & 0xFF] ^ ((crc32val >> 8) & 0x00FFFFFF);
+        for (size_t k = 0; k < CRC32_SLICE_BY - 1; k++)
+        {
+            c = crc32_tab[c & 0xFF] ^ (c >> 8);
+            crc32_slice[k][n] = c;
+        }
     }
+#endif
+}
+
+void crc32_init(crc32_ctx_t *ctx)
+{
+    ctx->crc = 0xFFFFFFFF;
+}
+
+void crc32_update(crc32_ctx_t *ctx, const unsigned char *s, size_t len)
+{
+    uint32_t crc32val = ctx->crc;
+
+#if CRC32_SLICE_BY > 1
+    /* 逐字节处理到 4 字节对齐, 之后按小端字读取 */
+    for (; len > 0 && ((uintptr_t)s & 0x3); len--)
+        crc32val = crc32_tab[(crc32val ^ *s++) & 0xFF] ^ (crc32val >> 8);
+
+    for (; len >= CRC32_SLICE_BY; len -= CRC32_SLICE_BY, s += CRC32_SLICE_BY) {
+        const uint32_t *w = (const uint32_t *)s;
+        uint32_t one = w[0] ^ crc32val;
+#if CRC32_SLICE_BY == 8
+        uint32_t two = w[1];
+        crc32val = crc32_slice[6][one & 0xFF]         ^ crc32_slice[5][(one >> 8) & 0xFF] ^
+                   crc32_slice[4][(one >> 16) & 0xFF] ^ crc32_slice[3][one >> 24]         ^
+                   crc32_slice[2][two & 0xFF]         ^ crc32_slice[1][(two >> 8) & 0xFF] ^
+                   crc32_slice[0][(two >> 16) & 0xFF] ^ crc32_tab[two >> 24];
+#else
+        crc32val = crc32_slice[2][one & 0xFF]         ^ crc32_slice[1][(one >> 8) & 0xFF] ^
+                   crc32_slice[0][(one >> 16) & 0xFF] ^ crc32_tab[one >> 24];
+#endif
+    }
+#endif
+
+    for (; len > 0; len--)
+        crc32val = crc32_tab[(crc32val ^ *s++) & 0xFF] ^ (crc32val >> 8);
+
+    ctx->crc = crc32val;
+}
+
+uint32_t crc32_final(const crc32_ctx_t *ctx)
+{
+    return ctx->crc ^ 0xFFFFFFFF;
+}
+
+/* crc32 hash */
+uint32_t crc32(const unsigned char *s, size_t len)
+{
+    crc32_ctx_t ctx;
 
-    return crc32val ^ 0xFFFFFFFF;
+    crc32_init(&ctx);
+    crc32_update(&ctx, s, len);
+    return crc32_final(&ctx);
 }
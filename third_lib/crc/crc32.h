@@ -8,6 +8,18 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+/* 流式计算: init -> update (可多次) -> final, 结果与一次性 crc32() 相同 */
+typedef struct {
+    uint32_t crc;
+} crc32_ctx_t;
+
+/* 推导 slicing 用的 RAM 表, 须在第一次计算前调用一次 */
+void crc32_tables_init(void);
+
+void crc32_init(crc32_ctx_t *ctx);
+void crc32_update(crc32_ctx_t *ctx, const unsigned char *s, size_t len);
+uint32_t crc32_final(const crc32_ctx_t *ctx);
+
 uint32_t crc32(const unsigned char *s, size_t len);
 
 #ifdef __cplusplus
@@ -0,0 +1,31 @@
+#ifndef _CRC_CRC_CONFIG_H
+#define _CRC_CRC_CONFIG_H
+
+/*
+ * 查表宽度, 在体积和速度之间取舍, 可在编译选项中覆盖 (test/crc_bench 按 1/4/8 分别编译比较):
+ *   1: 逐字节查表, 只用 flash 中的 256 项常量表
+ *   4: slicing-by-4, 每次处理 4 字节, 额外 3 张表 (crc16 1.5KB, crc32 3KB)
+ *   8: slicing-by-8, 每次处理 8 字节, 额外 7 张表 (crc16 3.5KB, crc32 7KB)
+ * 额外的表由 crc16_tables_init/crc32_tables_init 在启动时从常量表推导到 RAM, 不占用 flash。
+ */
+#ifndef CRC16_SLICE_BY
+#define CRC16_SLICE_BY      4
+#endif
+
+#ifndef CRC32_SLICE_BY
+#define CRC32_SLICE_BY      4
+#endif
+
+#if (CRC16_SLICE_BY != 1 && CRC16_SLICE_BY != 4 && CRC16_SLICE_BY != 8) || \
+    (CRC32_SLICE_BY != 1 && CRC32_SLICE_BY != 4 && CRC32_SLICE_BY != 8)
+#error "CRC16_SLICE_BY/CRC32_SLICE_BY must be 1, 4 or 8"
+#endif
+
+/* 推导出的表放在 CCM: CPU 零等待访问, 查表不受 flash 等待周期影响 */
+#if defined(__CC_ARM)
+#define CRC_TABLE_ATTR      __attribute__((section(".bss.ccm"), zero_init))
+#else
+#define CRC_TABLE_ATTR
+#endif
+
+#endif /* _CRC_CRC_CONFIG_H */
@@ -1,50 +1,180 @@
 #include "ringbuffer.h"
 #include <stddef.h>
+#include <string.h>
+
+#if defined(__CC_ARM)
+#define RB_BARRIER()    __dmb(0xF)
+#else
+#define RB_BARRIER()    __sync_synchronize()
+#endif
 
 //使用柔性数组来实现ringbuffer
 struct ringbuffer
 {
-    uint32_t size;         //buffer的大小
-    uint32_t read_index;   //读索引
-    uint32_t write_index;  //写索引
-    uint8_t buffer[];    //柔性数组成员，实际大小为size
+    uint32_t size;                  //数据区大小, 2 的幂
+    uint32_t mask;                  //size - 1
+    volatile uint32_t read_index;   //读索引, 自由递增, 仅消费者修改
+    volatile uint32_t write_index;  //写索引, 自由递增, 仅生产者修改
+    uint8_t buffer[];               //柔性数组成员，实际大小为size
 };
 
+typedef char rb_header_size_check[(sizeof(struct ringbuffer) == RB_HEADER_SIZE) ? 1 : -1];
+
 rb_t rb_init(uint8_t *buffer, uint32_t size)
 {
     if (buffer == NULL || size <= sizeof(struct ringbuffer))
         return NULL; // 总大小必须大于 ringbuffer 结构体以至少保留 1 字节数据
+
+    uint32_t data_size = size - sizeof(struct ringbuffer); //减去ringbuffer结构体的大小
+
+    /* 向下取整到 2 的幂 */
+    while (data_size & (data_size - 1))
+        data_size &= data_size - 1;
+
     rb_t rb = (rb_t)buffer;
-    rb->size = size - sizeof(struct ringbuffer); //减去ringbuffer结构体的大小
+    rb->size = data_size;
+    rb->mask = data_size - 1;
     rb->read_index = 0;
     rb->write_index = 0;
     return rb;
 }
 
- bool rb_is_empty(rb_t rb)
- {
+uint32_t rb_capacity(rb_t rb)
+{
+    return rb->size;
+}
+
+uint32_t rb_count(rb_t rb)
+{
+    return rb->write_index - rb->read_index;
+}
+
+uint32_t rb_space(rb_t rb)
+{
+    return rb->size - (rb->write_index - rb->read_index);
+}
+
+bool rb_is_empty(rb_t rb)
+{
     return rb->read_index == rb->write_index;
- }
+}
 
- bool rb_is_full(rb_t rb)
- {
-    return ((rb->write_index + 1) % rb->size) == rb->read_index;
- }
+bool rb_is_full(rb_t rb)
+{
+    return rb_count(rb) == rb->size;
+}
 
- bool rb_write(rb_t rb, uint8_t data)
- {
-    if (rb_is_full(rb))
+bool rb_write(rb_t rb, uint8_t data)
+{
+    uint32_t w = rb->write_index;
+
+    if (w - rb->read_index == rb->size)
         return false; //缓冲区满
-    rb->buffer[rb->write_index] = data;
-    rb->write_index = (rb->write_index + 1) % rb->size; //环形递增
+    rb->buffer[w & rb->mask] = data;
+    RB_BARRIER();   //数据先于索引可见
+    rb->write_index = w + 1;
     return true;
- }
+}
 
 bool rb_read(rb_t rb, uint8_t *data)
 {
-    if (rb_is_empty(rb))
+    uint32_t r = rb->read_index;
+
+    if (r == rb->write_index)
         return false; //缓冲区空
-    *data = rb->buffer[rb->read_index];
-    rb->read_index = (rb->read_index + 1) % rb->size; //环形递增
+    RB_BARRIER();   //读到索引后再读数据
+    *data = rb->buffer[r & rb->mask];
+    RB_BARRIER();   //数据读完后再释放空间
+    rb->read_index = r + 1;
     return true;
 }
+
+uint32_t rb_write_span(rb_t rb, uint8_t **span)
+{
+    uint32_t w = rb->write_index;
+    uint32_t space = rb->size - (w - rb->read_index);
+    uint32_t contig = rb->size - (w & rb->mask);
+
+    *span = &rb->buffer[w & rb->mask];
+    return space < contig ? space : contig;
+}
+
+void rb_commit_write(rb_t rb, uint32_t length)
+{
+    RB_BARRIER();
+    rb->write_index += length;
+}
+
+uint32_t rb_write_block(rb_t rb, const uint8_t *data, uint32_t length)
+{
+    uint32_t w = rb->write_index;
+    uint32_t space = rb->size - (w - rb->read_index);
+    uint32_t pos = w & rb->mask;
+
+    if (length > space)
+        length = space;
+
+    uint32_t first = rb->size - pos;
+    if (first > length)
+        first = length;
+
+    memcpy(&rb->buffer[pos], data, first);
+    memcpy(&rb->buffer[0], data + first, length - first);
+
+    RB_BARRIER();
+    rb->write_index = w + length;
+    return length;
+}
+
+uint32_t rb_peek_span(rb_t rb, uint32_t offset, const uint8_t **span)
+{
+    uint32_t r = rb->read_index + offset;
+    uint32_t count = rb->write_index - rb->read_index;
+
+    if (offset >= count)
+    {
+        *span = NULL;
+        return 0;
+    }
+
+    RB_BARRIER();
+    uint32_t avail = count - offset;
+    uint32_t contig = rb->size - (r & rb->mask);
+
+    *span = &rb->buffer[r & rb->mask];
+    return avail < contig ? avail : contig;
+}
+
+uint32_t rb_peek(rb_t rb, uint32_t offset, uint8_t *data, uint32_t length)
+{
+    uint32_t count = rb->write_index - rb->read_index;
+
+    if (offset >= count)
+        return 0;
+
+    RB_BARRIER();
+    if (length > count - offset)
+        length = count - offset;
+
+    uint32_t pos = (rb->read_index + offset) & rb->mask;
+    uint32_t first = rb->size - pos;
+    if (first > length)
+        first = length;
+
+    memcpy(data, &rb->buffer[pos], first);
+    memcpy(data + first, &rb->buffer[0], length - first);
+    return length;
+}
+
+void rb_commit_read(rb_t rb, uint32_t length)
+{
+    RB_BARRIER();
+    rb->read_index += length;
+}
+
+uint32_t rb_read_block(rb_t rb, uint8_t *data, uint32_t length)
+{
+    length = rb_peek(rb, 0, data, length);
+    rb_commit_read(rb, length);
+    return length;
+}
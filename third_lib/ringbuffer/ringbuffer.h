@@ -4,6 +4,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/*
+ * 单生产者/单消费者无锁环形缓冲 (如: 中断写, 主循环读)。
+ * 数据区大小为 2 的幂, 读写索引自由递增, 用掩码取模。
+ * 生产者只修改 write_index, 消费者只修改 read_index, 两侧之间用内存屏障保证顺序。
+ */
+
+/* 控制块占用的字节数, 传给 rb_init 的缓冲需额外预留 */
+#define RB_HEADER_SIZE          16
+#define RB_STORAGE_SIZE(n)      (RB_HEADER_SIZE + (n))
+
 struct ringbuffer;
 
 typedef struct ringbuffer* rb_t;
@@ -14,4 +24,21 @@ bool rb_is_full(rb_t rb);
 bool rb_write(rb_t rb, uint8_t data);
 bool rb_read(rb_t rb, uint8_t *data);
 
+uint32_t rb_capacity(rb_t rb);
+uint32_t rb_count(rb_t rb);
+uint32_t rb_space(rb_t rb);
+
+/* 批量读写, 返回实际处理的字节数 */
+uint32_t rb_write_block(rb_t rb, const uint8_t *data, uint32_t length);
+uint32_t rb_read_block(rb_t rb, uint8_t *data, uint32_t length);
+
+/* 消费者: 从 offset 处拷贝/取连续可读段, 不移动读索引; 处理完用 rb_commit_read 释放 */
+uint32_t rb_peek(rb_t rb, uint32_t offset, uint8_t *data, uint32_t length);
+uint32_t rb_peek_span(rb_t rb, uint32_t offset, const uint8_t **span);
+void rb_commit_read(rb_t rb, uint32_t length);
+
+/* 生产者: 取连续可写段直接填充, 再用 rb_commit_write 发布 */
+uint32_t rb_write_span(rb_t rb, uint8_t **span);
+void rb_commit_write(rb_t rb, uint32_t length);
+
 #endif /* __RING_BUFFER_H__ */
@@ -0,0 +1,199 @@
+# -*- coding: utf-8 -*-
+"""
+===============================================================
+bootloader 压缩会话 (BEGIN flags bit2) 使用的 LZ 压缩工具
+===============================================================
+
+【功能说明】
+输出 LZ4 block 格式的压缩流, 与设备端 app/bl_lz.c 配套:
+    - 匹配距离不超过 4096 (设备历史窗口 BL_LZ_WINDOW_SIZE)
+    - 最短匹配 4 字节, 最后一个 sequence 只有字面量
+压缩后会在本地解压一遍, 与原文件比较后再输出。
+
+BEGIN 中的 size/crc32 填原始镜像的长度和 CRC32, DATA 按 MTU 切分压缩流即可,
+切分位置不需要对齐。
+
+【使用方法】
+-----------------------------------------
+1️⃣ 压缩镜像：
+    python tools/bl_lz.py app.bin -o app.lz
+
+2️⃣ 同时估算不同波特率下的有效吞吐 (按原始镜像字节计)：
+    python tools/bl_lz.py app.bin --baud 115200 460800 921600 --mtu 4096
+   只按线路字节数计算, 不含应答、flash 编程和设备解码时间, 是理论上限;
+   解码速度的实测见 test/lz_bench.c。
+
+3️⃣ 解压 (用于检查)：
+    python tools/bl_lz.py app.lz -d -o app.bin
+"""
+
+import argparse
+import binascii
+import os
+import sys
+
+WINDOW_SIZE = 4096      # 与 BL_LZ_WINDOW_SIZE 一致
+MIN_MATCH = 4
+MAX_CHAIN = 32          # 每个位置最多回溯的候选数, 越大压缩率越高越慢
+
+FRAME_OVERHEAD = 6      # header + opcode + length + crc16
+DATA_SEQ_LEN = 2        # DATA 帧的 seq
+
+
+def _put_len(out, n):
+    """写入 token 之后的扩展长度字节"""
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _emit(out, literals, match_len, offset):
+    lit_len = len(literals)
+    token_lit = min(lit_len, 15)
+    token_match = 0 if match_len == 0 else min(match_len - MIN_MATCH, 15)
+    out.append((token_lit << 4) | token_match)
+    if lit_len >= 15:
+        _put_len(out, lit_len - 15)
+    out += literals
+    if match_len == 0:
+        return
+    out.append(offset & 0xFF)
+    out.append(offset >> 8)
+    if match_len - MIN_MATCH >= 15:
+        _put_len(out, match_len - MIN_MATCH - 15)
+
+
+def compress(data):
+    """贪心匹配, 以 4 字节为键的哈希链查找窗口内最长匹配"""
+    out = bytearray()
+    chains = {}
+    n = len(data)
+    pos = 0
+    anchor = 0
+
+    def insert(p):
+        key = data[p:p + MIN_MATCH]
+        chains.setdefault(key, []).append(p)
+
+    while pos + MIN_MATCH <= n:
+        key = data[pos:pos + MIN_MATCH]
+        best_len = 0
+        best_off = 0
+        cand = chains.get(key)
+        if cand:
+            for c in reversed(cand[-MAX_CHAIN:]):
+                off = pos - c
+                if off > WINDOW_SIZE:
+                    break
+                l = MIN_MATCH
+                while pos + l < n and data[c + l] == data[pos + l]:
+                    l += 1
+                if l > best_len:
+                    best_len, best_off = l, off
+        if best_len < MIN_MATCH:
+            insert(pos)
+            pos += 1
+            continue
+
+        _emit(out, data[anchor:pos], best_len, best_off)
+        for p in range(pos, min(pos + best_len, n - MIN_MATCH + 1)):
+            insert(p)
+        pos += best_len
+        anchor = pos
+
+    _emit(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress(src):
+    """与设备端解码器规则相同, 用于自检"""
+    out = bytearray()
+    i = 0
+    n = len(src)
+    while i < n:
+        token = src[i]
+        i += 1
+        lit_len = token >> 4
+        if lit_len == 15:
+            while True:
+                b = src[i]
+                i += 1
+                lit_len += b
+                if b != 255:
+                    break
+        out += src[i:i + lit_len]
+        i += lit_len
+        if i >= n:
+            break
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        if offset == 0 or offset > WINDOW_SIZE or offset > len(out):
+            raise ValueError("bad offset %d at input %d" % (offset, i - 2))
+        match_len = (token & 0x0F) + MIN_MATCH
+        if (token & 0x0F) == 15:
+            while True:
+                b = src[i]
+                i += 1
+                match_len += b
+                if b != 255:
+                    break
+        start = len(out) - offset
+        for k in range(match_len):
+            out.append(out[start + k])
+    return bytes(out)
+
+
+def wire_bytes(size, mtu):
+    """size 字节的 DATA 流按 mtu 切帧后在线路上的字节数"""
+    chunk = mtu - DATA_SEQ_LEN
+    frames = (size + chunk - 1) // chunk
+    return size + frames * (FRAME_OVERHEAD + DATA_SEQ_LEN)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="bootloader 压缩会话的 LZ 压缩/解压工具",
+        formatter_class=argparse.RawTextHelpFormatter
+    )
+    parser.add_argument("input", help="输入文件")
+    parser.add_argument("-o", "--output", help="输出文件")
+    parser.add_argument("-d", "--decompress", action="store_true", help="解压")
+    parser.add_argument("--baud", type=int, nargs="*", default=[],
+                        help="估算这些波特率下的有效吞吐 (8N1, 只计线路字节, 不计应答/编程/解码)")
+    parser.add_argument("--mtu", type=int, default=4096, help="单帧 payload 上限, 默认 4096")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    if args.decompress:
+        result = decompress(data)
+        print("decompressed: %d -> %d bytes, crc32 0x%08X"
+              % (len(data), len(result), binascii.crc32(result) & 0xFFFFFFFF))
+    else:
+        result = compress(data)
+        if decompress(result) != data:
+            print("❌ 自检失败: 解压结果与原文件不一致")
+            sys.exit(1)
+        ratio = len(result) / float(len(data)) if data else 1.0
+        print("compressed: %d -> %d bytes (%.1f%%), image crc32 0x%08X"
+              % (len(data), len(result), ratio * 100, binascii.crc32(data) & 0xFFFFFFFF))
+
+        if args.baud:
+            print("estimate from wire bytes only (not measured):")
+        for baud in args.baud:
+            line = baud / 10.0
+            raw_s = wire_bytes(len(data), args.mtu) / line
+            lz_s = wire_bytes(len(result), args.mtu) / line
+            print("  %7d baud: raw ~%6.2fs %7.0f B/s, lz ~%6.2fs %7.0f B/s effective (est.)"
+                  % (baud, raw_s, len(data) / raw_s, lz_s, len(data) / lz_s))
+
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(result)
+        print("✅ 已写入 %s" % os.path.abspath(args.output))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,215 @@
+# -*- coding: utf-8 -*-
+"""
+===============================================================
+bootloader 差分升级 (BEGIN flags bit3) 使用的补丁生成工具
+===============================================================
+
+【功能说明】
+以设备上当前安装的镜像为源, 生成 bsdiff 式补丁, 与设备端 app/bl_patch.c 配套:
+    | diff_len | extra_len | seek | diff | extra |, 控制字段为 LEB128, seek 为 zigzag
+diff 段是新旧镜像按字节相减的结果, 代码小改动时几乎全是 0, 因此默认再用
+tools/bl_lz.py 压缩一次 (对应 BEGIN flags bit2)。
+生成后会在本地应用一遍补丁, 与新镜像比较后再输出。
+
+设备以 arginfo 中的 CRC32 识别源镜像, 源镜像的长度和 CRC32 会一并打印,
+BEGIN 的 src_crc32 填这里打印的值。
+
+【使用方法】
+-----------------------------------------
+1️⃣ 生成补丁 (默认 LZ 压缩)：
+    python tools/bl_patch.py old.bin new.bin -o app.patch
+
+2️⃣ 生成不压缩的补丁：
+    python tools/bl_patch.py old.bin new.bin -o app.patch --no-lz
+"""
+
+import argparse
+import binascii
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import bl_lz  # noqa: E402
+
+KEY_LEN = 8             # 查找候选匹配的键长
+MIN_MATCH = 16          # 精确匹配不足该长度时按新增数据处理
+MAX_CAND = 16           # 每个键最多保留的源位置
+GIVE_UP = 64            # 近似扩展时连续这么多字节得分不再提高就停止
+
+
+def _varint(out, v):
+    while True:
+        b = v & 0x7F
+        v >>= 7
+        if v:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return
+
+
+def _zigzag(v):
+    return (v << 1) if v >= 0 else ((-v << 1) - 1)
+
+
+def _index(old):
+    idx = {}
+    for i in range(len(old) - KEY_LEN + 1):
+        lst = idx.setdefault(old[i:i + KEY_LEN], [])
+        if len(lst) < MAX_CAND:
+            lst.append(i)
+    return idx
+
+
+def _exact(old, new, o, p):
+    n = 0
+    limit = min(len(old) - o, len(new) - p)
+    while n < limit and old[o + n] == new[p + n]:
+        n += 1
+    return n
+
+
+def _extend(old, new, o, p, start):
+    """bsdiff 式近似扩展: 取使 (2 * 相同字节数 - 长度) 最大的长度, 改动的常量和地址一并走 diff"""
+    limit = min(len(old) - o, len(new) - p)
+    score = start
+    best_score = start
+    best = start
+    i = start
+    while i < limit and i - best < GIVE_UP:
+        if old[o + i] == new[p + i]:
+            score += 1
+        else:
+            score -= 1
+        i += 1
+        if score > best_score:
+            best_score, best = score, i
+    return best
+
+
+def _segments(old, new):
+    """找出新镜像中可以由源镜像近似得到的区段 [(new_pos, old_pos, length)]"""
+    idx = _index(old)
+    segs = []
+    pos = 0
+    n = len(new)
+    guess = 0       # 紧接上一段的源位置, 代码整体平移时最常命中
+
+    while pos + KEY_LEN <= n:
+        best_len = 0
+        best_old = 0
+        cands = list(idx.get(new[pos:pos + KEY_LEN], ()))
+        if guess < len(old):
+            cands.append(guess)
+        for o in cands:
+            l = _exact(old, new, o, pos)
+            if l > best_len:
+                best_len, best_old = l, o
+        if best_len < MIN_MATCH:
+            pos += 1
+            continue
+
+        length = _extend(old, new, best_old, pos, best_len)
+        segs.append((pos, best_old, length))
+        pos += length
+        guess = best_old + length
+    return segs
+
+
+def diff(old, new):
+    out = bytearray()
+    segs = _segments(old, new)
+
+    # 首条记录只有 extra, 随后每条记录为: 本段 diff + 到下一段之间的 extra + seek 到下一段源位置
+    src = 0
+    new_pos = 0
+    diff_len = 0
+    for seg_new, seg_old, length in segs + [(len(new), None, 0)]:
+        extra = new[new_pos + diff_len:seg_new]
+        target = seg_old if seg_old is not None else src + diff_len
+        _varint(out, diff_len)
+        _varint(out, len(extra))
+        _varint(out, _zigzag(target - (src + diff_len)))
+        out += bytes((new[new_pos + i] - old[src + i]) & 0xFF for i in range(diff_len))
+        out += extra
+        src, new_pos, diff_len = target, seg_new, length
+    return bytes(out)
+
+
+def apply(old, patch):
+    """与设备端规则相同, 用于自检"""
+    out = bytearray()
+    i = 0
+    src = 0
+
+    def varint():
+        nonlocal i
+        v = 0
+        shift = 0
+        while True:
+            b = patch[i]
+            i += 1
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    while i < len(patch):
+        diff_len = varint()
+        extra_len = varint()
+        zz = varint()
+        seek = (zz >> 1) ^ -(zz & 1)
+        if src + diff_len > len(old):
+            raise ValueError("diff beyond source at patch offset %d" % i)
+        out += bytes((old[src + k] + patch[i + k]) & 0xFF for k in range(diff_len))
+        i += diff_len
+        out += patch[i:i + extra_len]
+        i += extra_len
+        src += diff_len + seek
+        if not 0 <= src <= len(old):
+            raise ValueError("seek out of source at patch offset %d" % i)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="bootloader 差分升级补丁生成工具",
+        formatter_class=argparse.RawTextHelpFormatter
+    )
+    parser.add_argument("old", help="设备上当前的镜像")
+    parser.add_argument("new", help="新镜像")
+    parser.add_argument("-o", "--output", help="输出补丁文件")
+    parser.add_argument("--no-lz", action="store_true", help="不做 LZ 压缩")
+    args = parser.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+
+    patch = diff(old, new)
+    if apply(old, patch) != new:
+        print("❌ 自检失败: 应用补丁的结果与新镜像不一致")
+        sys.exit(1)
+
+    result = patch
+    if not args.no_lz:
+        result = bl_lz.compress(patch)
+        if bl_lz.decompress(result) != patch:
+            print("❌ 自检失败: LZ 解压结果与补丁不一致")
+            sys.exit(1)
+
+    print("source: %d bytes, crc32 0x%08X" % (len(old), binascii.crc32(old) & 0xFFFFFFFF))
+    print("target: %d bytes, crc32 0x%08X" % (len(new), binascii.crc32(new) & 0xFFFFFFFF))
+    print("patch:  %d bytes%s (%.1f%% of target)"
+          % (len(result), "" if args.no_lz else " after lz, %d raw" % len(patch),
+             100.0 * len(result) / max(len(new), 1)))
+
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(result)
+        print("✅ 已写入 %s" % os.path.abspath(args.output))
+
+
+if __name__ == "__main__":
+    main()